@@ -30,6 +30,7 @@ POSSIBILITY OF SUCH DAMAGE. */
 #define __gfxpoly_h__
 
 #include <stdint.h>
+#include <stddef.h>
 
 /* +----------------------------------------------------------------+ */
 /* |                           Definitions                          | */
@@ -98,6 +99,39 @@ void gfxpoly_destroy(gfxpoly_t*poly);
 
 gfxpoly_t* gfxpoly_intersect(gfxpoly_t*p1, gfxpoly_t*p2);
 gfxpoly_t* gfxpoly_union(gfxpoly_t*p1, gfxpoly_t*p2);
+gfxpoly_t* gfxpoly_subtract(gfxpoly_t*p1, gfxpoly_t*p2);
+
+/* Union of n polygons (n > 0, each filled even/odd). Every operand is first
+   swept on its own, which orients its edges consistently, and then all of
+   them are unioned in a single sweep which counts windings. */
+gfxpoly_t* gfxpoly_union_many(gfxpoly_t**polys, int n);
+
+/* A boolean expression over up to 64 polygons (each filled even/odd), which
+   is evaluated in a single sweep over all of them, without creating the
+   intermediate results. Operands are referred to by their index in the
+   polys array, and combined with | (union), & (intersection), - (difference),
+   ^ (symmetric difference), ! (complement) and parentheses, e.g.
+   "(0|1) - (2&3)". & binds tighter than the other binary operators, which
+   are applied from left to right. gfxpoly_expr_new returns NULL if the
+   expression has a syntax error, or would fill the area outside of all
+   polygons (like "!0" does). gfxpoly_expr_evaluate returns NULL if polys
+   has fewer entries than the expression refers to. An expression remembers
+   the combinations of operands it was evaluated for, so it must not be
+   evaluated on several threads at once. */
+typedef struct _gfxpoly_expr gfxpoly_expr_t;
+gfxpoly_expr_t* gfxpoly_expr_new(const char*expr);
+gfxpoly_t* gfxpoly_expr_evaluate(gfxpoly_expr_t*expr, gfxpoly_t**polys, int num);
+void gfxpoly_expr_destroy(gfxpoly_expr_t*expr);
+
+/* Predicates on the filled areas of two polygons (filled even/odd). They
+   stop sweeping as soon as the answer is known.
+   intersects: the areas overlap
+   contains: p2's area lies completely inside p1's
+   touches: the outlines meet (up to the grid resolution), but the areas
+            don't overlap */
+char gfxpoly_intersects(gfxpoly_t*p1, gfxpoly_t*p2);
+char gfxpoly_contains(gfxpoly_t*p1, gfxpoly_t*p2);
+char gfxpoly_touches(gfxpoly_t*p1, gfxpoly_t*p2);
 
 gfxpoly_t* gfxpoly_selfintersect_evenodd(gfxpoly_t*p);
 gfxpoly_t* gfxpoly_selfintersect_circular(gfxpoly_t*p);
@@ -112,6 +146,7 @@ typedef struct _moments {
 } moments_t;
 
 double gfxpoly_area(gfxpoly_t*p);
+double gfxpoly_perimeter(gfxpoly_t*p);
 double gfxpoly_intersection_area(gfxpoly_t*p1, gfxpoly_t*p2);
 moments_t gfxpoly_moments(gfxpoly_t*p);
 
@@ -216,4 +251,235 @@ extern windrule_t windrule_subtract;
 
 gfxpoly_t* gfxpoly_process(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments);
 
+/* Same as gfxpoly_process, for num polygons, which are passed to the
+   windrule as polygon_nr 0...num-1. */
+gfxpoly_t* gfxpoly_process_many(gfxpoly_t**polys, int num, windrule_t*windrule, windcontext_t*context, moments_t*moments);
+
+/* Same as gfxpoly_process, but cuts the polygon into horizontal bands which are
+   processed on num_threads threads (num_threads<=0 means one thread per cpu).
+   The resulting polygon has the same edges as the one gfxpoly_process returns
+   (they're just possibly grouped into strokes differently). To make that
+   possible, the sweep processes events at the same position in a fixed
+   order. That order differs from the one older versions got out of the
+   event queue, so where segments lie on top of each other, the result of
+   gfxpoly_process can differ from that of older versions, too: a pair of
+   coincident edges with opposite directions may appear or disappear. */
+gfxpoly_t* gfxpoly_process_parallel(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments, int num_threads);
+
+/* An incremental sweep keeps the bands of a sweep like the one of
+   gfxpoly_process_parallel around, so that after replacing some strokes of
+   an operand, only the bands those strokes cross need to be swept again
+   (band boundaries are chosen once, so that there are num_bands bands with
+   roughly the same number of edges, or one per couple of thousand edges if
+   num_bands<=0). The operands must stay around, and must only be changed
+   through gfxpoly_incremental_update: it unlinks the removed strokes (which
+   must be strokes of operand polygon_nr) from the operand and frees them,
+   adds the added ones (a list, now owned by the operand), and sweeps the
+   affected bands. gfxpoly_incremental_result returns a new polygon with the
+   same edges gfxpoly_process would give for the current operands. */
+typedef struct _gfxpoly_incremental gfxpoly_incremental_t;
+gfxpoly_incremental_t* gfxpoly_incremental_new(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, int num_bands);
+void gfxpoly_incremental_update(gfxpoly_incremental_t*inc, int polygon_nr, gfxsegmentlist_t**removed, int num_removed, gfxsegmentlist_t*added);
+gfxpoly_t* gfxpoly_incremental_result(gfxpoly_incremental_t*inc);
+void gfxpoly_incremental_destroy(gfxpoly_incremental_t*inc);
+
+/* An engine keeps the sweep's buffers (event queue, active list, segment
+   memory etc.) around between operations, so that running many small
+   operations doesn't spend most of its time in malloc. An engine must only
+   be used by one thread at a time. */
+typedef struct _gfxpoly_engine gfxpoly_engine_t;
+gfxpoly_engine_t* gfxpoly_engine_new();
+gfxpoly_t* gfxpoly_engine_process(gfxpoly_engine_t*engine, gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments);
+void gfxpoly_engine_destroy(gfxpoly_engine_t*engine);
+
+/* The active list (the segments crossing the current scanline) is indexed
+   by one of these. Which one is fastest depends on the input:
+
+   ACTLIST_SPLAYTREE: a splay tree, threaded through the segments
+   ACTLIST_BLOCKS:    the list, chopped into arrays of segment pointers
+   ACTLIST_SKIPLIST:  a skip list on top of the segment list
+
+   Engines start out with ACTLIST_DEFAULT (ACTLIST_BLOCKS unless set at
+   compile time). gfxpoly_engine_set_actlist changes it for all following
+   operations on the engine. */
+typedef enum {ACTLIST_SPLAYTREE, ACTLIST_BLOCKS, ACTLIST_SKIPLIST} actlist_type_t;
+void gfxpoly_engine_set_actlist(gfxpoly_engine_t*engine, actlist_type_t type);
+
+/* Runs the same sweep as gfxpoly_process, but only measures the result
+   instead of building it. moments (area and moments) and perimeter (the
+   total length of the result's edges) are in real coordinates, and either
+   can be NULL. */
+void gfxpoly_measure(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments, double*perimeter);
+void gfxpoly_engine_measure(gfxpoly_engine_t*engine, gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments, double*perimeter);
+
+/* Streams the result of a sweep into a sink instead of building a
+   gfxpoly_t. Every edge of the result is passed to edge() while the
+   scanline it ends on is processed, and scanline(y) is called once all the
+   edges ending at or above y have been. The sweep doesn't keep the edges
+   around afterwards, so its memory use only depends on how many edges cross
+   a scanline, not on the size of the result. a is the upper end of the edge
+   (or the left one, for horizontal edges), dir is as in gfxsegmentlist_t.
+   Joining the edges into strokes is up to the sink. setgridsize, scanline
+   and finish can be NULL. Returns what finish returns. */
+typedef struct _gfxpoly_sink {
+    void (*setgridsize)(struct _gfxpoly_sink*sink, double gridsize);
+    void (*edge)(struct _gfxpoly_sink*sink, gridpoint_t a, gridpoint_t b, segment_dir_t dir, edgestyle_t*fs);
+    void (*scanline)(struct _gfxpoly_sink*sink, int32_t y);
+    void* (*finish)(struct _gfxpoly_sink*sink);
+    void*internal;
+} gfxpoly_sink_t;
+
+void* gfxpoly_process_to_sink(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, gfxpoly_sink_t*sink);
+void* gfxpoly_engine_process_to_sink(gfxpoly_engine_t*engine, gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, gfxpoly_sink_t*sink);
+
+/* +----------------------------------------------------------------+ */
+/* |                          Point queries                         | */
+/* +----------------------------------------------------------------+ */
+
+/* A prepared polygon stores the ordered edges between every two scanlines
+   of a sweep over the polygon, together with the windstates between them.
+   Queries then take two binary searches. Results are exact up to the grid
+   resolution. Note that the index stores every edge once for every
+   scanline it crosses, so it can get large for polygons with many long
+   edges. */
+typedef struct _gfxpoly_prepared gfxpoly_prepared_t;
+gfxpoly_prepared_t* gfxpoly_prepare(gfxpoly_t*poly, windrule_t*windrule, windcontext_t*context);
+windstate_t gfxpoly_prepared_query(gfxpoly_prepared_t*prepared, gfxcoord_t x, gfxcoord_t y);
+char gfxpoly_prepared_contains(gfxpoly_prepared_t*prepared, gfxcoord_t x, gfxcoord_t y);
+/* queries num points at once (which is fastest if they're sorted by y) */
+void gfxpoly_prepared_query_batch(gfxpoly_prepared_t*prepared, const gfxcoord_t*x, const gfxcoord_t*y, int num, windstate_t*result);
+void gfxpoly_prepared_destroy(gfxpoly_prepared_t*prepared);
+
+/* +----------------------------------------------------------------+ */
+/* |                     Clipping against a mask                    | */
+/* +----------------------------------------------------------------+ */
+
+/* A mask prepares a polygon for intersecting many (typically smaller)
+   polygons with it: its start events are sorted once, and indexed by y.
+   Clipping a polygon then only sweeps the scanlines of that polygon, and
+   only the mask edges crossing them. The result is the same as that of
+   gfxpoly_intersect(poly, mask), up to the grid resolution (mask edges
+   coming in from above aren't snapped to the mask's hot pixels above the
+   polygon). Like there, both are filled even/odd. The mask polygon must
+   stay around as long as the mask does. A mask is only read while
+   clipping, so it can be shared between threads (each with its own
+   engine). */
+typedef struct _gfxpoly_mask gfxpoly_mask_t;
+gfxpoly_mask_t* gfxpoly_mask_new(gfxpoly_t*poly);
+gfxpoly_t* gfxpoly_clip(gfxpoly_mask_t*mask, gfxpoly_t*poly);
+gfxpoly_t* gfxpoly_engine_clip(gfxpoly_engine_t*engine, gfxpoly_mask_t*mask, gfxpoly_t*poly);
+void gfxpoly_mask_destroy(gfxpoly_mask_t*mask);
+
+/* +----------------------------------------------------------------+ */
+/* |                        Batch processing                        | */
+/* +----------------------------------------------------------------+ */
+
+typedef struct _gfxpoly_job {
+    gfxpoly_t*poly1;
+    gfxpoly_t*poly2;
+    windrule_t*windrule;
+    windcontext_t*context;
+    gfxpoly_t*result;
+} gfxpoly_job_t;
+
+/* Runs gfxpoly_process() on every job, distributing them over num_threads
+   threads (num_threads<=0 means one thread per cpu). The result of each job
+   is stored in its result field. Windrules and contexts need to be safe to
+   use from several threads at once (the builtin ones are). */
+void gfxpoly_process_batch(gfxpoly_job_t*jobs, int num_jobs, int num_threads);
+
+/* +----------------------------------------------------------------+ */
+/* |                         Result cache                           | */
+/* +----------------------------------------------------------------+ */
+
+/* A cache for the results of gfxpoly_process, for when the same operations
+   (e.g. the same glyph outline clipped against the same box) come up over
+   and over. Operations are identified by the contents of the operands
+   (including their gridsize), the windrule's functions, and the context's
+   user pointer and num_polygons. Whatever the user pointer refers to must
+   not change while the cache holds results computed with it (destroy the
+   cache first, or use a different one). Results are shared: they must not
+   be modified, and every result gfxpoly_cache_process returns has to be
+   given back with gfxpoly_cache_release instead of gfxpoly_destroy. The
+   cache keeps at most max_size bytes of operands and results, dropping the
+   least recently used ones first (results still in use stay valid until
+   they're released). Can be used from several threads at once. */
+typedef struct _gfxpoly_cache gfxpoly_cache_t;
+typedef struct _gfxpoly_cache_stats {
+    long hits;
+    long misses;
+    long evictions;
+    int num_entries;
+    size_t size;
+} gfxpoly_cache_stats_t;
+
+gfxpoly_cache_t* gfxpoly_cache_new(size_t max_size);
+gfxpoly_t* gfxpoly_cache_process(gfxpoly_cache_t*cache, gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context);
+void gfxpoly_cache_release(gfxpoly_cache_t*cache, gfxpoly_t*result);
+void gfxpoly_cache_get_stats(gfxpoly_cache_t*cache, gfxpoly_cache_stats_t*stats);
+void gfxpoly_cache_destroy(gfxpoly_cache_t*cache);
+
+/* +----------------------------------------------------------------+ */
+/* |                        Packed polygons                         | */
+/* +----------------------------------------------------------------+ */
+
+/* The same data as a gfxpoly_t, but with the points of all strokes in one
+   array instead of a list of separately allocated strokes, so walking over
+   a polygon streams through memory. Stroke n has the points
+   points[offsets[n]] ... points[offsets[n+1]-1] (offsets has num_strokes+1
+   entries), and direction dirs[n] and edgestyle fs[n]. A packed polygon is
+   a single allocation, unless it was mapped from a file. */
+typedef struct _gfxpoly_packed {
+    double gridsize;
+    int num_strokes;
+    int num_points;
+    gridpoint_t*points;
+    int*offsets;
+    segment_dir_t*dirs;
+    edgestyle_t**fs;
+
+    /* set if points, offsets and dirs are in a mapped file */
+    void*mapping;
+    size_t mapping_size;
+} gfxpoly_packed_t;
+
+/* allocates a packed polygon for num_strokes strokes with num_points points
+   in total. Only offsets[num_strokes] is set (to num_points), the caller
+   fills in the rest. */
+gfxpoly_packed_t* gfxpoly_packed_new(double gridsize, int num_strokes, int num_points);
+gfxpoly_packed_t* gfxpoly_pack(gfxpoly_t*poly);
+gfxpoly_t* gfxpoly_unpack(gfxpoly_packed_t*packed);
+gfxpoly_packed_t* gfxpoly_packed_from_fill(gfxline_t*line, double gridsize);
+gfxpoly_packed_t* gfxpoly_packed_from_file(const char*filename);
+void gfxpoly_packed_save(gfxpoly_packed_t*poly, const char*filename);
+/* like gfxline_from_gfxpoly_with_direction, but the strokes are written in
+   the order they're stored in: a stroke is only joined to the one before it
+   if it starts where that one ended. */
+gfxline_t* gfxline_from_gfxpoly_packed(gfxpoly_packed_t*poly);
+gfxbbox_t gfxpoly_packed_calculate_bbox(gfxpoly_packed_t*poly);
+void gfxpoly_packed_destroy(gfxpoly_packed_t*poly);
+
+/* A binary file format, which has the point, offset and direction arrays of
+   a packed polygon as they are in memory (behind a header with a version
+   number, the gridsize and the sizes), so it can be loaded without parsing:
+   gfxpoly_packed_map maps the file into memory and points the packed
+   polygon into the mapping, without copying the arrays.
+   gfxpoly_from_binary_file does copy them: the strokes of a gfxpoly_t own
+   their points (gfxpoly_destroy frees them), so it unpacks the mapped
+   polygon and unmaps the file again. To work on the mapping itself, use
+   gfxpoly_packed_map and the functions for packed polygons.
+   Edgestyles aren't stored (on loading, all strokes get the default one),
+   and the file is in the byte order of the machine that wrote it. Loading
+   returns NULL if the file can't be read, has a different version or byte
+   order, or is damaged. */
+void gfxpoly_packed_save_binary(gfxpoly_packed_t*poly, const char*filename);
+void gfxpoly_save_binary(gfxpoly_t*poly, const char*filename);
+gfxpoly_packed_t* gfxpoly_packed_map(const char*filename);
+gfxpoly_t* gfxpoly_from_binary_file(const char*filename);
+
+/* gfxpoly_process for packed polygons. The operands are swept without
+   unpacking them, and the result is packed straight from the sweep. */
+gfxpoly_packed_t* gfxpoly_process_packed(gfxpoly_packed_t*poly1, gfxpoly_packed_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments);
+gfxpoly_packed_t* gfxpoly_engine_process_packed(gfxpoly_engine_t*engine, gfxpoly_packed_t*poly1, gfxpoly_packed_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments);
+
 #endif
@@ -31,13 +31,25 @@ POSSIBILITY OF SUCH DAMAGE. */
 #include <math.h>
 #include "active.h"
 
-actlist_t* actlist_new()
+
+static void actlist_blocks_destroy(actlist_t*a);
+static void actlist_skiplist_destroy(actlist_t*a);
+
+actlist_t* actlist_new_type(actlist_type_t type)
 {
     actlist_t*a = (actlist_t*)calloc(1, sizeof(actlist_t));
+    a->type = type;
+    a->seed = 0x2545f491;
     return a;
 }
+actlist_t* actlist_new()
+{
+    return actlist_new_type(ACTLIST_DEFAULT);
+}
 void actlist_destroy(actlist_t*a)
 {
+    actlist_blocks_destroy(a);
+    actlist_skiplist_destroy(a);
     free(a);
 }
 
@@ -106,42 +118,32 @@ static inline double cmp(segment_t*s, point_t p1, point_t p2)
     return d;
 }
 
+/* the list is sorted, so single_cmp() changes its sign only once along it.
+   Given the last segment left of p1 (by single_cmp()), this finds the
+   segment immediately to the left of p1, taking the tie break with p2
+   into account */
+static segment_t* actlist_find_finish(actlist_t*a, segment_t*s, point_t p1, point_t p2)
+{
+    if (!s) {
+        s = a->list;
+        if (!s || cmp(s, p1, p2)<0)
+            return 0;
+    }
+    while (s->right && cmp(s->right, p1, p2)>=0) {
+        s = s->right;
+    }
+    return s;
+}
+
 #ifdef SPLAY
 static void actlist_splay_dump(actlist_t*a);
-segment_t* actlist_find(actlist_t*a, point_t p1, point_t p2)
+static segment_t* actlist_tree_find(actlist_t*a, point_t p1, point_t p2)
 {
-#ifdef CHECKS
-    segment_t*t = a->list;
-    char to_the_left = 0;
-    while (t) {
-        /* this check doesn't work out with cmp() because during horizontal
-           processing, both segments ending as well as segments starting will
-           be active in this scanline */
-        //double d = cmp(t, p1, p2);
-        double d = single_cmp(t, p1);
-        if (d>=0 && to_the_left) {
-            actlist_dump(a, p1.y, 1);
-            segment_t*s = a->list;
-            while (s) {
-                fprintf(stderr, "[%d] %f/%f (%d,%d) -> (%d,%d)\n", SEGNR(s),
-                        single_cmp(s,p1), cmp(s,p1,p2),
-                        s->a.x, s->a.y, s->b.x, s->b.y);
-                s = s->right;
-            }
-        }
-        assert(!(d>=0 && to_the_left));
-        if (d<0) to_the_left=1;
-        t = t->right;
-    }
-#if 0
-    if (a->size > 100) {
-        static actlist_t*last = 0;
-        if (last != a) {
-            last = a;
-            actlist_splay_dump(a);
-        }
+#if defined(CHECKS) && defined(ACTLIST_STATS)
+    if (a->size > 100 && !a->dumped) {
+        a->dumped = 1;
+        actlist_splay_dump(a);
     }
-#endif
 #endif
     segment_t*last=0, *s = a->root;
     if (!s) return 0;
@@ -157,25 +159,21 @@ segment_t* actlist_find(actlist_t*a, point_t p1, point_t p2)
             s = s->rightchild;
         }
     }
-//#ifdef DEBUG
-#if 0
+#ifdef ACTLIST_STATS
     if (a->size > 1) {
         /* 80% hit, average cost per miss ~ 4 nodes */
         int expected_depth = (int)((double)log2((double)a->size+1))+1;
-        static int hits = 0;
-        static int misses = 0;
-        static int miss_cost = 0;
-        if (depth <= expected_depth) hits++;
-        else {misses++;
-            miss_cost += depth - expected_depth;
+        if (depth <= expected_depth) a->find_hits++;
+        else {a->find_misses++;
+            a->find_miss_cost += depth - expected_depth;
         }
-        if (hits && misses)
-            fprintf(stderr, "%02.2f%% %f\n", hits / (double)(hits+misses), miss_cost / (double)misses);
+        if (a->find_hits && a->find_misses)
+            fprintf(stderr, "%02.2f%% %f\n", a->find_hits / (double)(a->find_hits+a->find_misses),
+                    a->find_miss_cost / (double)a->find_misses);
     }
 #endif
 
     /* this can be optimized for (is not needed in) normal mode (as opposed to horizontal postprocess mode) */
-    segment_t*out = last;
     if (d<0 || (d==0 && LINE_EQ(p2,last)<0)) {
         last = last->left;
         if (!last) {
@@ -188,50 +186,16 @@ segment_t* actlist_find(actlist_t*a, point_t p1, point_t p2)
         }
     }
 
-#ifdef CHECKS
-    segment_t*l=0;
-    s = a->list;
-    while (s) {
-        if (cmp(s, p1, p2)<0)
-            break;
-        l = s;s = s->right;
-    }
-    if (l!=last) {
-        printf("[%d]!=[%d]\n", SEGNR(l), SEGNR(last));
-        printf("after tree: [%d]\n", SEGNR(out));
-        actlist_splay_dump(a);
-        s = a->list;
-        while (s) {
-            double d1 = single_cmp(s,p1);
-            double d2 = cmp(s,p1,p2);
-            int x1 = d1<0?-1:(d1>0?1:0);
-            int x2 = d2<0?-1:(d2>0?1:0);
-            printf("[%d](%d,%d) ", SEGNR(s), x1, x2);
-            s = s->right;
-        }
-        printf("\n");
-    }
-    assert(l == last);
-#endif
-
     return last;
 }
 #else
-segment_t* actlist_find(actlist_t*a, point_t p1, point_t p2)
+static segment_t* actlist_tree_find(actlist_t*a, point_t p1, point_t p2)
 {
-    segment_t*last=0, *s = a->list;
-    if (!s) return last;
-    while (s) {
-        double d = cmp(s, p1, p2);
-        if (d<0)
-            break;
-        last = s;
-        s = s->right;
-    }
-    return last;
+    return actlist_find_finish(a, 0, p1, p2);
 }
 #endif
 
+
 #ifdef SPLAY
 
 #define LINK(node,side,child) (node)->side = (child);if (child) {(child)->parent = (node);}
@@ -454,26 +418,490 @@ static void actlist_splay(actlist_t*a, point_t p1, point_t p2)
 
 #endif
 
-static void actlist_insert_after(actlist_t*a, segment_t*left, segment_t*s)
+/* ------------------------------ block list ------------------------------ */
+
+/* The segments, in list order, chopped into blocks of up to ACTBLOCK_SIZE
+   pointers. Finding a position is a binary search over the blocks, followed by
+   a binary search inside a block, and touches far fewer cache lines than
+   walking a tree of segments. */
+
+static actblock_t* actblock_new()
 {
-#ifdef SPLAY
-    //fprintf(stderr, "insert [%d] after [%d]\n", SEGNR(s), SEGNR(left));
-    //actlist_splay_dump(a);
-    //actlist_dump(a, s->a.y);
-#endif
+    return (actblock_t*)calloc(1, sizeof(actblock_t));
+}
 
-    s->left = left;
+static inline int actblock_index(actblock_t*b, segment_t*s)
+{
+    int t;
+    for(t=0;t<b->num;t++) {
+        if (b->segs[t] == s)
+            return t;
+    }
+    assert(0);
+    return -1;
+}
+
+static void actlist_blocks_insert_block(actlist_t*a, int pos, actblock_t*b)
+{
+    if (a->num_blocks == a->blocks_size) {
+        a->blocks_size = a->blocks_size<16?16:a->blocks_size*2;
+        a->blocks = (actblock_t**)realloc(a->blocks, sizeof(actblock_t*)*a->blocks_size);
+    }
+    memmove(&a->blocks[pos+1], &a->blocks[pos], sizeof(actblock_t*)*(a->num_blocks-pos));
+    a->blocks[pos] = b;
+    a->num_blocks++;
+    int t;
+    for(t=pos;t<a->num_blocks;t++) {
+        a->blocks[t]->pos = t;
+    }
+}
+
+static void actlist_blocks_remove_block(actlist_t*a, actblock_t*b)
+{
+    int pos = b->pos;
+    assert(a->blocks[pos] == b);
+    memmove(&a->blocks[pos], &a->blocks[pos+1], sizeof(actblock_t*)*(a->num_blocks-pos-1));
+    a->num_blocks--;
+    int t;
+    for(t=pos;t<a->num_blocks;t++) {
+        a->blocks[t]->pos = t;
+    }
+    free(b);
+}
+
+// appends block c to block b, and removes c
+static void actlist_blocks_merge(actlist_t*a, actblock_t*b, actblock_t*c)
+{
+    assert(b->num + c->num <= ACTBLOCK_SIZE);
+    int t;
+    for(t=0;t<c->num;t++) {
+        c->segs[t]->block = b;
+        b->segs[b->num++] = c->segs[t];
+    }
+    actlist_blocks_remove_block(a, c);
+}
+
+static segment_t* actlist_blocks_find(actlist_t*a, point_t p1)
+{
+    /* find the last block starting to the left of p1 */
+    int l = 0, r = a->num_blocks;
+    while (l < r) {
+        int m = (l+r)/2;
+        if (single_cmp(a->blocks[m]->segs[0], p1)>0)
+            l = m+1;
+        else
+            r = m;
+    }
+    if (!l)
+        return 0;
+    actblock_t*b = a->blocks[l-1];
+    l = 1, r = b->num;
+    while (l < r) {
+        int m = (l+r)/2;
+        if (single_cmp(b->segs[m], p1)>0)
+            l = m+1;
+        else
+            r = m;
+    }
+    return b->segs[l-1];
+}
+
+static void actlist_blocks_insert_after(actlist_t*a, segment_t*left, segment_t*s)
+{
+    actblock_t*b;
+    int pos;
     if (left) {
-        s->right = left->right;
+        b = left->block;
+        pos = actblock_index(b, left)+1;
     } else {
-        s->right = a->list;
-        a->list = s;
+        if (!a->num_blocks)
+            actlist_blocks_insert_block(a, 0, actblock_new());
+        b = a->blocks[0];
+        pos = 0;
     }
-    if (s->left)
-        s->left->right = s;
-    if (s->right)
-        s->right->left = s;
+    if (b->num == ACTBLOCK_SIZE) {
+        /* split */
+        actblock_t*n = actblock_new();
+        int half = ACTBLOCK_SIZE/2, t;
+        for(t=half;t<ACTBLOCK_SIZE;t++) {
+            n->segs[n->num++] = b->segs[t];
+            b->segs[t]->block = n;
+        }
+        b->num = half;
+        actlist_blocks_insert_block(a, b->pos+1, n);
+        if (pos > half) {
+            b = n;
+            pos -= half;
+        }
+    }
+    memmove(&b->segs[pos+1], &b->segs[pos], sizeof(segment_t*)*(b->num-pos));
+    b->segs[pos] = s;
+    b->num++;
+    s->block = b;
+}
+
+static void actlist_blocks_delete(actlist_t*a, segment_t*s)
+{
+    actblock_t*b = s->block;
+    int pos = actblock_index(b, s);
+    memmove(&b->segs[pos], &b->segs[pos+1], sizeof(segment_t*)*(b->num-pos-1));
+    b->num--;
+    s->block = 0;
+    if (!b->num) {
+        actlist_blocks_remove_block(a, b);
+        return;
+    }
+    /* keep the blocks reasonably full */
+    if (b->pos+1 < a->num_blocks && b->num + a->blocks[b->pos+1]->num <= ACTBLOCK_SIZE/2) {
+        actlist_blocks_merge(a, b, a->blocks[b->pos+1]);
+    }
+    if (b->pos > 0 && a->blocks[b->pos-1]->num + b->num <= ACTBLOCK_SIZE/2) {
+        actlist_blocks_merge(a, a->blocks[b->pos-1], b);
+    }
+}
+
+static void actlist_blocks_swap(actlist_t*a, segment_t*s1, segment_t*s2)
+{
+    actblock_t*b1 = s1->block;
+    actblock_t*b2 = s2->block;
+    int i1 = actblock_index(b1, s1);
+    int i2 = actblock_index(b2, s2);
+    b1->segs[i1] = s2;
+    b2->segs[i2] = s1;
+    s1->block = b2;
+    s2->block = b1;
+}
+
+static void actlist_blocks_fill(actlist_t*a, segment_t**segs, int num)
+{
+    actblock_t*b = 0;
+    int t;
+    for(t=0;t<num;t++) {
+        if (!b || b->num == ACTBLOCK_SIZE*3/4) {
+            b = actblock_new();
+            actlist_blocks_insert_block(a, a->num_blocks, b);
+        }
+        b->segs[b->num++] = segs[t];
+        segs[t]->block = b;
+    }
+}
+
+static int actlist_blocks_verify(actlist_t*a)
+{
+    segment_t*s = a->list;
+    int t, i;
+    for(t=0;t<a->num_blocks;t++) {
+        actblock_t*b = a->blocks[t];
+        if (b->pos != t || !b->num)
+            return 0;
+        for(i=0;i<b->num;i++) {
+            if (b->segs[i] != s || s->block != b)
+                return 0;
+            s = s->right;
+        }
+    }
+    return !s;
+}
+
+static void actlist_blocks_destroy(actlist_t*a)
+{
+    int t;
+    for(t=0;t<a->num_blocks;t++) {
+        free(a->blocks[t]);
+    }
+    free(a->blocks);
+    a->blocks = 0;
+    a->num_blocks = 0;
+}
+
+/* ------------------------------ skip list ------------------------------- */
+
+/* The segment list itself is the bottom level of the skip list. Roughly every
+   fourth segment has a node linking it into level 0 of the upper levels,
+   every 16th into level 1, and so on. Nodes link to nodes, not to segments,
+   so swapping two segments only needs to swap their nodes. */
+
+#define SKIP_NEXT(n,l) ((n)->link[2*(l)])
+#define SKIP_PREV(n,l) ((n)->link[2*(l)+1])
+
+static inline uint32_t actlist_random(actlist_t*a)
+{
+    /* xorshift32 */
+    uint32_t x = a->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return a->seed = x;
+}
+
+static skipnode_t* skipnode_new(segment_t*s, int height)
+{
+    skipnode_t*n = (skipnode_t*)calloc(1, sizeof(skipnode_t)+sizeof(skipnode_t*)*2*height);
+    n->s = s;
+    n->height = height;
+    return n;
+}
+
+static int actlist_skiplist_height(actlist_t*a)
+{
+    uint32_t r = actlist_random(a);
+    int height = 0;
+    while (height < SKIPLIST_MAXLEVEL && !(r&3)) {
+        height++;
+        r >>= 2;
+    }
+    return height;
+}
+
+static segment_t* actlist_skiplist_find(actlist_t*a, point_t p1)
+{
+    if (!a->skiphead)
+        return 0;
+    skipnode_t*n = a->skiphead;
+    int l;
+    for(l=a->skipheight-1;l>=0;l--) {
+        while (SKIP_NEXT(n,l) && single_cmp(SKIP_NEXT(n,l)->s, p1)>0) {
+            n = SKIP_NEXT(n,l);
+        }
+    }
+    segment_t*s = n->s;
+    segment_t*next = s ? s->right : a->list;
+    while (next && single_cmp(next, p1)>0) {
+        s = next;
+        next = s->right;
+    }
+    return s;
+}
+
+static void actlist_skiplist_link(actlist_t*a, segment_t*s, int height)
+{
+    s->skipnode = 0;
+    if (!height)
+        return;
+    if (!a->skiphead)
+        a->skiphead = skipnode_new(0, SKIPLIST_MAXLEVEL);
+    if (height > a->skipheight)
+        a->skipheight = height;
+
+    skipnode_t*n = skipnode_new(s, height);
+    s->skipnode = n;
+
+    /* find our predecessor on each level, starting from our left neighbor */
+    segment_t*left = s->left;
+    while (left && !left->skipnode)
+        left = left->left;
+    skipnode_t*p = left ? left->skipnode : a->skiphead;
+    int l;
+    for(l=0;l<height;l++) {
+        while (p->height <= l)
+            p = SKIP_PREV(p,l-1);
+        SKIP_PREV(n,l) = p;
+        SKIP_NEXT(n,l) = SKIP_NEXT(p,l);
+        if (SKIP_NEXT(p,l))
+            SKIP_PREV(SKIP_NEXT(p,l),l) = n;
+        SKIP_NEXT(p,l) = n;
+    }
+}
+
+static void actlist_skiplist_delete(actlist_t*a, segment_t*s)
+{
+    skipnode_t*n = s->skipnode;
+    if (!n)
+        return;
+    int l;
+    for(l=0;l<n->height;l++) {
+        SKIP_NEXT(SKIP_PREV(n,l),l) = SKIP_NEXT(n,l);
+        if (SKIP_NEXT(n,l))
+            SKIP_PREV(SKIP_NEXT(n,l),l) = SKIP_PREV(n,l);
+    }
+    free(n);
+    s->skipnode = 0;
+}
+
+static void actlist_skiplist_swap(actlist_t*a, segment_t*s1, segment_t*s2)
+{
+    skipnode_t*n1 = s1->skipnode;
+    skipnode_t*n2 = s2->skipnode;
+    s1->skipnode = n2;
+    s2->skipnode = n1;
+    if (n1) n1->s = s2;
+    if (n2) n2->s = s1;
+}
+
+static void actlist_skiplist_fill(actlist_t*a, segment_t**segs, int num)
+{
+    int t;
+    for(t=0;t<num;t++) {
+        actlist_skiplist_link(a, segs[t], actlist_skiplist_height(a));
+    }
+}
+
+static int actlist_skiplist_verify(actlist_t*a)
+{
+    if (!a->skiphead)
+        return !a->list || !a->list->skipnode;
+    /* level 0 contains exactly the segments with nodes, in list order */
+    skipnode_t*n = SKIP_NEXT(a->skiphead,0);
+    segment_t*s;
+    for(s=a->list;s;s=s->right) {
+        if (!s->skipnode)
+            continue;
+        if (s->skipnode != n || n->s != s)
+            return 0;
+        n = SKIP_NEXT(n,0);
+    }
+    if (n)
+        return 0;
+    /* every level is a sublist of the one below */
+    int l;
+    for(l=0;l<SKIPLIST_MAXLEVEL;l++) {
+        skipnode_t*lower = a->skiphead;
+        skipnode_t*prev = a->skiphead;
+        for(n=SKIP_NEXT(a->skiphead,l);n;n=SKIP_NEXT(n,l)) {
+            if (n->height <= l || SKIP_PREV(n,l) != prev)
+                return 0;
+            if (l) {
+                while (lower && lower != n)
+                    lower = SKIP_NEXT(lower,l-1);
+                if (!lower)
+                    return 0;
+            }
+            prev = n;
+        }
+    }
+    return 1;
+}
+
+static void actlist_skiplist_destroy(actlist_t*a)
+{
+    if (!a->skiphead)
+        return;
+    skipnode_t*n = a->skiphead;
+    while (n) {
+        skipnode_t*next = SKIP_NEXT(n,0);
+        free(n);
+        n = next;
+    }
+    a->skiphead = 0;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static void actlist_check_find(actlist_t*a, point_t p1, point_t p2, segment_t*last)
+{
+#ifdef CHECKS
+    segment_t*t = a->list;
+    char to_the_left = 0;
+    while (t) {
+        /* this check doesn't work out with cmp() because during horizontal
+           processing, both segments ending as well as segments starting will
+           be active in this scanline */
+        //double d = cmp(t, p1, p2);
+        double d = single_cmp(t, p1);
+        if (d>=0 && to_the_left) {
+            actlist_dump(a, p1.y, 1);
+            segment_t*s = a->list;
+            while (s) {
+                fprintf(stderr, "[%d] %f/%f (%d,%d) -> (%d,%d)\n", SEGNR(s),
+                        single_cmp(s,p1), cmp(s,p1,p2),
+                        s->a.x, s->a.y, s->b.x, s->b.y);
+                s = s->right;
+            }
+        }
+        assert(!(d>=0 && to_the_left));
+        if (d<0) to_the_left=1;
+        t = t->right;
+    }
+
+    segment_t*l=0, *s = a->list;
+    while (s) {
+        if (cmp(s, p1, p2)<0)
+            break;
+        l = s;s = s->right;
+    }
+    if (l!=last) {
+        printf("[%d]!=[%d]\n", SEGNR(l), SEGNR(last));
+        s = a->list;
+        while (s) {
+            double d1 = single_cmp(s,p1);
+            double d2 = cmp(s,p1,p2);
+            int x1 = d1<0?-1:(d1>0?1:0);
+            int x2 = d2<0?-1:(d2>0?1:0);
+            printf("[%d](%d,%d) ", SEGNR(s), x1, x2);
+            s = s->right;
+        }
+        printf("\n");
+    }
+    assert(l == last);
+#endif
+}
+
+segment_t* actlist_find(actlist_t*a, point_t p1, point_t p2)
+{
+    segment_t*s;
+    switch(a->type) {
+        case ACTLIST_BLOCKS:
+            s = actlist_find_finish(a, actlist_blocks_find(a, p1), p1, p2);
+        break;
+        case ACTLIST_SKIPLIST:
+            s = actlist_find_finish(a, actlist_skiplist_find(a, p1), p1, p2);
+        break;
+        default:
+            s = actlist_tree_find(a, p1, p2);
+        break;
+    }
+    actlist_check_find(a, p1, p2, s);
+    return s;
+}
 
+/* Queries on a scanline typically come in x order, so the result is usually
+   close to the previous one. Walk from there for a few steps before falling
+   back to a search from scratch. */
+#define FINGER_STEPS 16
+segment_t* actlist_find_from(actlist_t*a, segment_t*finger, point_t p1, point_t p2)
+{
+    segment_t*s = finger;
+    int steps = 0;
+    if (s && cmp(s, p1, p2)<0) {
+        /* walk left */
+        do {
+            s = s->left;
+            if (++steps > FINGER_STEPS)
+                return actlist_find(a, p1, p2);
+        } while (s && cmp(s, p1, p2)<0);
+    } else {
+        /* walk right */
+        segment_t*next = s ? s->right : a->list;
+        while (next && cmp(next, p1, p2)>=0) {
+            s = next;
+            next = s->right;
+            if (++steps > FINGER_STEPS)
+                return actlist_find(a, p1, p2);
+        }
+    }
+    actlist_check_find(a, p1, p2, s);
+    return s;
+}
+
+static int actlist_index_verify(actlist_t*a)
+{
+    switch(a->type) {
+        case ACTLIST_BLOCKS:
+            return actlist_blocks_verify(a);
+        case ACTLIST_SKIPLIST:
+            return actlist_skiplist_verify(a);
+        default:
+#ifdef SPLAY
+            return actlist_splay_verify(a);
+#else
+            return 1;
+#endif
+    }
+}
+
+
+static void actlist_tree_insert_after(actlist_t*a, segment_t*left, segment_t*s)
+{
 #ifdef SPLAY
     // we insert nodes not trees
     assert(!s->leftchild);
@@ -492,31 +920,13 @@ static void actlist_insert_after(actlist_t*a, segment_t*left, segment_t*s)
     }
     a->root = s;
     a->root->parent = 0;
-
-    assert(actlist_splay_verify(a));
 #endif
-
-    a->size++;
 }
 
-void actlist_delete(actlist_t*a, segment_t*s)
+static void actlist_tree_delete(actlist_t*a, segment_t*s)
 {
 #ifdef SPLAY
-    assert(actlist_splay_verify(a));
     move_to_root(a, s);
-    assert(actlist_splay_verify(a));
-#endif
-    if (s->left) {
-        s->left->right = s->right;
-    } else {
-        a->list = s->right;
-    }
-    if (s->right) {
-        s->right->left = s->left;
-    }
-    s->left = s->right = 0;
-    a->size--;
-#ifdef SPLAY
     assert(a->root == s);
     // delete root node
     if (!a->root->leftchild) {
@@ -525,7 +935,7 @@ void actlist_delete(actlist_t*a, segment_t*s)
         a->root = a->root->leftchild;
     } else {
 #ifdef HAVE_LRAND48
-        if (lrand48()&1) {
+        if (nrand48(a->rand48)&1) {
 #else
         if (((uintptr_t)s)&16) {
 #endif
@@ -561,10 +971,64 @@ void actlist_delete(actlist_t*a, segment_t*s)
     if (a->root)
         a->root->parent = 0;
     s->leftchild = s->rightchild = s->parent = 0;
-
-    assert(actlist_splay_verify(a));
 #endif
 }
+
+static void actlist_insert_after(actlist_t*a, segment_t*left, segment_t*s)
+{
+    s->left = left;
+    if (left) {
+        s->right = left->right;
+    } else {
+        s->right = a->list;
+        a->list = s;
+    }
+    if (s->left)
+        s->left->right = s;
+    if (s->right)
+        s->right->left = s;
+
+    switch(a->type) {
+        case ACTLIST_BLOCKS:
+            actlist_blocks_insert_after(a, left, s);
+        break;
+        case ACTLIST_SKIPLIST:
+            actlist_skiplist_link(a, s, actlist_skiplist_height(a));
+        break;
+        default:
+            actlist_tree_insert_after(a, left, s);
+        break;
+    }
+    a->size++;
+    assert(actlist_index_verify(a));
+}
+
+void actlist_delete(actlist_t*a, segment_t*s)
+{
+    assert(actlist_index_verify(a));
+    switch(a->type) {
+        case ACTLIST_BLOCKS:
+            actlist_blocks_delete(a, s);
+        break;
+        case ACTLIST_SKIPLIST:
+            actlist_skiplist_delete(a, s);
+        break;
+        default:
+            actlist_tree_delete(a, s);
+        break;
+    }
+    if (s->left) {
+        s->left->right = s->right;
+    } else {
+        a->list = s->right;
+    }
+    if (s->right) {
+        s->right->left = s->left;
+    }
+    s->left = s->right = 0;
+    a->size--;
+    assert(actlist_index_verify(a));
+}
 int actlist_size(actlist_t*a)
 {
     return a->size;
@@ -596,36 +1060,50 @@ void actlist_insert(actlist_t*a, point_t p1, point_t p2, segment_t*s)
     actlist_insert_after(a, left, s);
 }
 
-void actlist_swap(actlist_t*a, segment_t*s1, segment_t*s2)
-{
 #ifdef SPLAY
-    assert(actlist_splay_verify(a));
+static segment_t* actlist_build_tree(segment_t**segs, int start, int end, segment_t*parent)
+{
+    if (start >= end)
+        return 0;
+    int mid = (start+end)/2;
+    segment_t*s = segs[mid];
+    s->parent = parent;
+    s->leftchild = actlist_build_tree(segs, start, mid, s);
+    s->rightchild = actlist_build_tree(segs, mid+1, end, s);
+    return s;
+}
 #endif
-#ifdef CHECKS
-    /* test that s1 is to the left of s2- our swap
-       code depends on that */
-    segment_t*s = s1;
-    while (s && s!=s2) s = s->right;
-    assert(s==s2);
+
+void actlist_fill(actlist_t*a, segment_t**segs, int num)
+{
+    assert(!a->list);
+    int t;
+    for(t=0;t<num;t++) {
+        segs[t]->left = t ? segs[t-1] : 0;
+        segs[t]->right = t<num-1 ? segs[t+1] : 0;
+    }
+    a->list = num ? segs[0] : 0;
+    a->size = num;
+    switch(a->type) {
+        case ACTLIST_BLOCKS:
+            actlist_blocks_fill(a, segs, num);
+        break;
+        case ACTLIST_SKIPLIST:
+            actlist_skiplist_fill(a, segs, num);
+        break;
+        default:
+#ifdef SPLAY
+            /* inserting one by one would leave us with a degenerated tree, so
+               build a balanced one right away */
+            a->root = actlist_build_tree(segs, 0, num, 0);
 #endif
-/*#ifndef SPLAY
-    actlist_delete(a, s1);
-    actlist_insert_after(a, s2, s1);
-#else*/
-    segment_t*s1l = s1->left;
-    segment_t*s1r = s1->right;
-    segment_t*s2l = s2->left;
-    segment_t*s2r = s2->right;
-    if (s1l) s1l->right = s2;
-    else    a->list = s2;
-    s2->left = s1l;
-    if (s2r) s2r->left = s1;
-    s1->right = s2r;
-    if (s2l!=s1) s1->left = s2l;
-    else        s1->left = s2;
-    if (s1r!=s2) s2->right = s1r;
-    else        s2->right = s1;
+        break;
+    }
+    assert(actlist_index_verify(a));
+}
 
+static void actlist_tree_swap(actlist_t*a, segment_t*s1, segment_t*s2)
+{
 #ifdef SPLAY
     if (s2->parent==s1) {
         /*
@@ -704,9 +1182,47 @@ void actlist_swap(actlist_t*a, segment_t*s1, segment_t*s2)
     if (s2->leftchild) s2->leftchild->parent = s2;
     if (s1->rightchild) s1->rightchild->parent = s1;
     if (s2->rightchild) s2->rightchild->parent = s2;
+#endif
+}
 
-    assert(actlist_splay_verify(a));
+void actlist_swap(actlist_t*a, segment_t*s1, segment_t*s2)
+{
+    assert(actlist_index_verify(a));
+#ifdef CHECKS
+    /* test that s1 is to the left of s2- our swap
+       code depends on that */
+    segment_t*s = s1;
+    while (s && s!=s2) s = s->right;
+    assert(s==s2);
 #endif
+/*#ifndef SPLAY
+    actlist_delete(a, s1);
+    actlist_insert_after(a, s2, s1);
+#else*/
+    segment_t*s1l = s1->left;
+    segment_t*s1r = s1->right;
+    segment_t*s2l = s2->left;
+    segment_t*s2r = s2->right;
+    if (s1l) s1l->right = s2;
+    else    a->list = s2;
+    s2->left = s1l;
+    if (s2r) s2r->left = s1;
+    s1->right = s2r;
+    if (s2l!=s1) s1->left = s2l;
+    else        s1->left = s2;
+    if (s1r!=s2) s2->right = s1r;
+    else        s2->right = s1;
 
-//#endif
+    switch(a->type) {
+        case ACTLIST_BLOCKS:
+            actlist_blocks_swap(a, s1, s2);
+        break;
+        case ACTLIST_SKIPLIST:
+            actlist_skiplist_swap(a, s1, s2);
+        break;
+        default:
+            actlist_tree_swap(a, s1, s2);
+        break;
+    }
+    assert(actlist_index_verify(a));
 }
@@ -31,12 +31,50 @@ POSSIBILITY OF SUCH DAMAGE. */
 
 #include "poly.h"
 
+/* The active list is a doubly linked list of segments (left/right), plus an
+   index for finding positions in it. The index implementations are listed
+   in gfxpoly.h (actlist_type_t). */
+
+#ifndef ACTLIST_DEFAULT
+#define ACTLIST_DEFAULT ACTLIST_BLOCKS
+#endif
+
+#define ACTBLOCK_SIZE 64
+typedef struct _actblock {
+    int num;
+    int pos;
+    segment_t*segs[ACTBLOCK_SIZE];
+} actblock_t;
+
+#define SKIPLIST_MAXLEVEL 12
+typedef struct _skipnode {
+    segment_t*s;
+    int height;
+    struct _skipnode*link[0]; // next and previous node, for every level
+} skipnode_t;
+
 typedef struct _actlist
 {
     segment_t*list;
     int size;
+    actlist_type_t type;
 #ifdef SPLAY
     segment_t*root;
+#endif
+    actblock_t**blocks;
+    int num_blocks;
+    int blocks_size;
+    skipnode_t*skiphead;
+    int skipheight;
+    uint32_t seed;
+#ifdef HAVE_LRAND48
+    unsigned short rand48[3];
+#endif
+#ifdef ACTLIST_STATS
+    char dumped;
+    int find_hits;
+    int find_misses;
+    int find_miss_cost;
 #endif
 } actlist_t;
 
@@ -44,12 +82,15 @@ typedef struct _actlist
 #define actlist_right(a,s) ((s)?(s)->right:(a)->list)
 
 actlist_t* actlist_new();
+actlist_t* actlist_new_type(actlist_type_t type);
 void actlist_destroy(actlist_t*a);
 int actlist_size(actlist_t*a);
 void actlist_verify(actlist_t*a, int32_t y);
 void actlist_dump(actlist_t*a, int32_t y, double gridsize);
 segment_t* actlist_find(actlist_t*a, point_t p1, point_t p2);  // finds segment immediately to the left of p1 (breaking ties w/ p2)
+segment_t* actlist_find_from(actlist_t*a, segment_t*finger, point_t p1, point_t p2); // same, starting the search at a previous result (0 = start of list)
 void actlist_insert(actlist_t*a, point_t p1, point_t p2, segment_t*s);
+void actlist_fill(actlist_t*a, segment_t**segs, int num); // segs must be sorted from left to right
 void actlist_delete(actlist_t*a, segment_t*s);
 void actlist_swap(actlist_t*a, segment_t*s1, segment_t*s2);
 segment_t* actlist_leftmost(actlist_t*a);
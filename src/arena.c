@@ -0,0 +1,123 @@
+/* arena.c
+
+Bump allocation for data that lives as long as one polygon operation
+
+Copyright (c) 2012 Matthias Kramm <kramm@quiss.org>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE. */
+
+#include <stdlib.h>
+#include <memory.h>
+#include "arena.h"
+
+/* all returned pointers are aligned to this */
+#define ARENA_ALIGN 16
+#define ALIGN(x) (((x)+(ARENA_ALIGN-1))&~(size_t)(ARENA_ALIGN-1))
+#define BLOCK_HEADER ALIGN(sizeof(arena_block_t))
+#define BLOCK_DATA(b) (((char*)(b))+BLOCK_HEADER)
+
+arena_t* arena_new(size_t block_size)
+{
+    arena_t*a = (arena_t*)calloc(1, sizeof(arena_t));
+    a->block_size = block_size?block_size:65536;
+    return a;
+}
+
+static arena_block_t* arena_add_block(arena_t*a, size_t size)
+{
+    arena_block_t*b;
+    if (size <= a->block_size && a->spare) {
+        b = a->spare;
+        a->spare = b->next;
+    } else {
+        size_t block_size = a->block_size;
+        if (size > block_size)
+            block_size = size;
+        b = (arena_block_t*)malloc(BLOCK_HEADER + block_size);
+        b->size = block_size;
+    }
+    b->used = 0;
+    if (a->blocks && size > a->block_size) {
+        /* oversized allocations get their own block, which we append after
+           the current one so that we can keep filling the latter */
+        b->next = a->blocks->next;
+        a->blocks->next = b;
+    } else {
+        b->next = a->blocks;
+        a->blocks = b;
+    }
+    return b;
+}
+
+void* arena_alloc(arena_t*a, size_t size)
+{
+    size = ALIGN(size);
+    arena_block_t*b = a->blocks;
+    if (!b || b->used + size > b->size) {
+        b = arena_add_block(a, size);
+    }
+    void*p = BLOCK_DATA(b) + b->used;
+    b->used += size;
+    return p;
+}
+
+void* arena_calloc(arena_t*a, size_t size)
+{
+    void*p = arena_alloc(a, size);
+    memset(p, 0, size);
+    return p;
+}
+
+void arena_reset(arena_t*a)
+{
+    /* keep the regular sized blocks for the next round of allocations,
+       free the oversized ones */
+    arena_block_t*b = a->blocks;
+    while (b) {
+        arena_block_t*next = b->next;
+        if (b->size == a->block_size) {
+            b->next = a->spare;
+            a->spare = b;
+        } else {
+            free(b);
+        }
+        b = next;
+    }
+    a->blocks = 0;
+}
+
+static void free_blocks(arena_block_t*b)
+{
+    while (b) {
+        arena_block_t*next = b->next;
+        free(b);
+        b = next;
+    }
+}
+
+void arena_destroy(arena_t*a)
+{
+    free_blocks(a->blocks);
+    free_blocks(a->spare);
+    free(a);
+}
@@ -0,0 +1,88 @@
+/* arena.h
+
+Bump allocation for data that lives as long as one polygon operation
+
+Copyright (c) 2012 Matthias Kramm <kramm@quiss.org>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef __arena_h__
+#define __arena_h__
+
+#include <stddef.h>
+
+/* An arena hands out memory by bumping a pointer through large blocks.
+   Nothing allocated from an arena can be freed individually- everything
+   goes away at once in arena_destroy() (or arena_reset(), which keeps
+   the blocks around for reuse). */
+
+typedef struct _arena_block {
+    struct _arena_block*next;
+    size_t size;
+    size_t used;
+} arena_block_t;
+
+typedef struct _arena {
+    arena_block_t*blocks;
+    arena_block_t*spare; // emptied by arena_reset()
+    size_t block_size;
+} arena_t;
+
+arena_t* arena_new(size_t block_size);
+void* arena_alloc(arena_t*a, size_t size);
+void* arena_calloc(arena_t*a, size_t size);
+void arena_reset(arena_t*a);
+void arena_destroy(arena_t*a);
+
+/* A slab recycles fixed-size objects on top of an arena. Freed objects
+   go into a free list (threaded through their first bytes) and are
+   handed out again before we bump the arena any further. */
+
+typedef struct _slab {
+    arena_t*arena;
+    size_t size;
+    void*free;
+} slab_t;
+
+static inline void slab_init(slab_t*s, arena_t*a, size_t size)
+{
+    s->arena = a;
+    s->size = size<sizeof(void*)?sizeof(void*):size;
+    s->free = 0;
+}
+static inline void* slab_alloc(slab_t*s)
+{
+    void*p = s->free;
+    if (p) {
+        s->free = *(void**)p;
+        return p;
+    }
+    return arena_alloc(s->arena, s->size);
+}
+static inline void slab_free(slab_t*s, void*p)
+{
+    *(void**)p = s->free;
+    s->free = p;
+}
+
+#endif
@@ -0,0 +1,171 @@
+/* batch.c
+
+Running many independent polygon operations on a thread pool
+
+Copyright (c) 2012 Matthias Kramm <kramm@quiss.org>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE. */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "gfxpoly.h"
+#include "poly.h"
+
+/* Every worker owns a contiguous range [start,end) of job indices. It takes
+   jobs from the front of its own range, and when that runs dry, steals the
+   back half of another worker's range. Jobs never produce new jobs, so once
+   a worker finds every range empty, it can quit. */
+
+typedef struct _worker {
+    pthread_mutex_t mutex;
+    int start;
+    int end;
+} worker_t;
+
+typedef struct _batch {
+    gfxpoly_job_t*jobs;
+    worker_t*workers;
+    int num_workers;
+} batch_t;
+
+typedef struct _worker_arg {
+    batch_t*batch;
+    int nr;
+} worker_arg_t;
+
+static int worker_next_job(worker_t*w)
+{
+    int nr = -1;
+    pthread_mutex_lock(&w->mutex);
+    if (w->start < w->end)
+        nr = w->start++;
+    pthread_mutex_unlock(&w->mutex);
+    return nr;
+}
+
+static char worker_steal(batch_t*batch, int self)
+{
+    worker_t*me = &batch->workers[self];
+    int t;
+    for(t=1;t<batch->num_workers;t++) {
+        worker_t*victim = &batch->workers[(self+t)%batch->num_workers];
+        int start=0, end=0;
+        pthread_mutex_lock(&victim->mutex);
+        int left = victim->end - victim->start;
+        if (left > 0) {
+            /* leave the victim the front half (the part it's about to work on),
+               take the rest. If there's only one job left, take that. */
+            end = victim->end;
+            start = victim->end - (left+1)/2;
+            victim->end = start;
+        }
+        pthread_mutex_unlock(&victim->mutex);
+
+        if (start < end) {
+            pthread_mutex_lock(&me->mutex);
+            me->start = start;
+            me->end = end;
+            pthread_mutex_unlock(&me->mutex);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void* worker_run(void*_arg)
+{
+    worker_arg_t*arg = (worker_arg_t*)_arg;
+    batch_t*batch = arg->batch;
+    worker_t*w = &batch->workers[arg->nr];
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    while (1) {
+        int nr = worker_next_job(w);
+        if (nr < 0) {
+            if (!worker_steal(batch, arg->nr))
+                break;
+            continue;
+        }
+        gfxpoly_job_t*job = &batch->jobs[nr];
+        job->result = gfxpoly_engine_process(engine, job->poly1, job->poly2, job->windrule, job->context, 0);
+    }
+    gfxpoly_engine_destroy(engine);
+    return 0;
+}
+
+void gfxpoly_process_batch(gfxpoly_job_t*jobs, int num_jobs, int num_threads)
+{
+    int t;
+    if (num_threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? (int)cpus : 1;
+    }
+    if (num_threads > num_jobs)
+        num_threads = num_jobs;
+    if (num_threads <= 1) {
+        gfxpoly_engine_t*engine = gfxpoly_engine_new();
+        for(t=0;t<num_jobs;t++) {
+            jobs[t].result = gfxpoly_engine_process(engine, jobs[t].poly1, jobs[t].poly2, jobs[t].windrule, jobs[t].context, 0);
+        }
+        gfxpoly_engine_destroy(engine);
+        return;
+    }
+
+    batch_t batch;
+    batch.jobs = jobs;
+    batch.num_workers = num_threads;
+    batch.workers = (worker_t*)malloc(sizeof(worker_t)*num_threads);
+    worker_arg_t*args = (worker_arg_t*)malloc(sizeof(worker_arg_t)*num_threads);
+    pthread_t*threads = (pthread_t*)malloc(sizeof(pthread_t)*num_threads);
+
+    for(t=0;t<num_threads;t++) {
+        worker_t*w = &batch.workers[t];
+        pthread_mutex_init(&w->mutex, 0);
+        w->start = (int)((int64_t)num_jobs*t/num_threads);
+        w->end = (int)((int64_t)num_jobs*(t+1)/num_threads);
+        args[t].batch = &batch;
+        args[t].nr = t;
+    }
+
+    /* worker 0 is the calling thread */
+    int started = 1;
+    for(t=1;t<num_threads;t++) {
+        if (pthread_create(&threads[t], 0, worker_run, &args[t]))
+            break;
+        started++;
+    }
+    /* if we couldn't start all threads, the ranges of the missing workers
+       get stolen by the ones we have */
+    worker_run(&args[0]);
+    for(t=1;t<started;t++) {
+        pthread_join(threads[t], 0);
+    }
+
+    for(t=0;t<num_threads;t++) {
+        pthread_mutex_destroy(&batch.workers[t].mutex);
+    }
+    free(threads);
+    free(args);
+    free(batch.workers);
+}
@@ -0,0 +1,205 @@
+/* binfile.c
+
+A binary file format for packed polygons, which is loaded by mapping it
+
+Copyright (c) 2012 Matthias Kramm <kramm@quiss.org>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "gfxpoly.h"
+#include "poly.h"
+#include "convert.h"
+
+/* The file is the header, followed by the points, the num_strokes+1 offsets
+   and the num_strokes directions of the polygon, exactly as they are laid
+   out in a gfxpoly_packed_t. The header is a multiple of 8 bytes long, so
+   all the arrays are aligned in the mapping. */
+#define BINARY_MAGIC 0x50584647 // "GFXP" in little endian byte order
+#define BINARY_VERSION 1
+
+typedef struct _binheader {
+    uint32_t magic; // also tells us whether the byte order is ours
+    uint32_t version;
+    double gridsize;
+    uint32_t num_strokes;
+    uint32_t num_points;
+} binheader_t;
+
+static uint64_t binary_size(uint64_t num_strokes, uint64_t num_points)
+{
+    return sizeof(binheader_t) +
+           sizeof(point_t)*num_points +
+           sizeof(int)*(num_strokes+1) +
+           sizeof(segment_dir_t)*num_strokes;
+}
+
+static FILE* binary_create(const char*filename, double gridsize, int num_strokes, int num_points)
+{
+    FILE*fi = fopen(filename, "wb");
+    if (!fi) {
+        perror(filename);
+        return 0;
+    }
+    binheader_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = BINARY_MAGIC;
+    h.version = BINARY_VERSION;
+    h.gridsize = gridsize;
+    h.num_strokes = num_strokes;
+    h.num_points = num_points;
+    fwrite(&h, sizeof(h), 1, fi);
+    return fi;
+}
+
+void gfxpoly_packed_save_binary(gfxpoly_packed_t*poly, const char*filename)
+{
+    FILE*fi = binary_create(filename, poly->gridsize, poly->num_strokes, poly->num_points);
+    if (!fi)
+        return;
+    fwrite(poly->points, sizeof(point_t), poly->num_points, fi);
+    fwrite(poly->offsets, sizeof(int), poly->num_strokes+1, fi);
+    fwrite(poly->dirs, sizeof(segment_dir_t), poly->num_strokes, fi);
+    fclose(fi);
+}
+
+void gfxpoly_save_binary(gfxpoly_t*poly, const char*filename)
+{
+    int num_strokes = 0, num_points = 0;
+    gfxsegmentlist_t*stroke;
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        num_strokes++;
+        num_points += stroke->num_points;
+    }
+    FILE*fi = binary_create(filename, poly->gridsize, num_strokes, num_points);
+    if (!fi)
+        return;
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        fwrite(stroke->points, sizeof(point_t), stroke->num_points, fi);
+    }
+    int pos = 0;
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        fwrite(&pos, sizeof(int), 1, fi);
+        pos += stroke->num_points;
+    }
+    fwrite(&pos, sizeof(int), 1, fi);
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        fwrite(&stroke->dir, sizeof(segment_dir_t), 1, fi);
+    }
+    fclose(fi);
+}
+
+/* the strokes have to be valid for the sweep not to run off the arrays:
+   every stroke needs at least two points, and they have to be sorted by y */
+static char binary_check(binheader_t*h, point_t*points, int*offsets, segment_dir_t*dirs)
+{
+    if (offsets[0] != 0 || offsets[h->num_strokes] != h->num_points)
+        return 0;
+    uint32_t t;
+    for(t=0;t<h->num_strokes;t++) {
+        if ((int64_t)offsets[t+1] - offsets[t] < 2)
+            return 0;
+        if (dirs[t] != DIR_UP && dirs[t] != DIR_DOWN)
+            return 0;
+    }
+    /* all the offsets are within the points array now */
+    for(t=0;t<h->num_strokes;t++) {
+        int p;
+        for(p=offsets[t]+1;p<offsets[t+1];p++) {
+            if (points[p].y < points[p-1].y)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+gfxpoly_packed_t* gfxpoly_packed_map(const char*filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < sizeof(binheader_t)) {
+        close(fd);
+        return 0;
+    }
+    size_t size = st.st_size;
+    /* a private, writable mapping, so that modifying the polygon is possible
+       (and doesn't touch the file) */
+    void*mapping = mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror(filename);
+        return 0;
+    }
+
+    binheader_t*h = (binheader_t*)mapping;
+    point_t*points = (point_t*)&h[1];
+    int*offsets = (int*)&points[h->num_points];
+    segment_dir_t*dirs = (segment_dir_t*)&offsets[h->num_strokes+1];
+    if (h->magic != BINARY_MAGIC || h->version != BINARY_VERSION ||
+        h->num_strokes > INT_MAX || h->num_points > INT_MAX ||
+        binary_size(h->num_strokes, h->num_points) != size ||
+        !binary_check(h, points, offsets, dirs)) {
+        fprintf(stderr, "%s: not a polygon file (or a different version of the format)\n", filename);
+        munmap(mapping, size);
+        return 0;
+    }
+
+    /* only the edgestyles need memory of their own */
+    gfxpoly_packed_t*p = (gfxpoly_packed_t*)malloc(sizeof(gfxpoly_packed_t) + sizeof(edgestyle_t*)*h->num_strokes);
+    p->gridsize = h->gridsize;
+    p->num_strokes = h->num_strokes;
+    p->num_points = h->num_points;
+    p->points = points;
+    p->offsets = offsets;
+    p->dirs = dirs;
+    p->fs = (edgestyle_t**)&p[1];
+    int t;
+    for(t=0;t<p->num_strokes;t++) {
+        p->fs[t] = &edgestyle_default;
+    }
+    p->mapping = mapping;
+    p->mapping_size = size;
+    return p;
+}
+
+gfxpoly_t* gfxpoly_from_binary_file(const char*filename)
+{
+    gfxpoly_packed_t*packed = gfxpoly_packed_map(filename);
+    if (!packed)
+        return 0;
+    gfxpoly_t*poly = gfxpoly_unpack(packed);
+    gfxpoly_packed_destroy(packed);
+    return poly;
+}
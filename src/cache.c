@@ -0,0 +1,347 @@
+/* cache.c
+
+Caching the results of polygon operations.
+
+Copyright (c) 2012 Matthias Kramm <kramm@quiss.org>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE. */
+
+#include <stdlib.h>
+#include <memory.h>
+#include <pthread.h>
+#include "gfxpoly.h"
+#include "poly.h"
+
+/* Entries are found through a hash of the operands, the windrule and the
+   context, and then compared against packed copies of the operands and
+   copies of the windrule and the context. So a hash collision can't return
+   a wrong result, and windrules and contexts don't need to outlive the
+   cache (they may, e.g., live on the stack). An entry is referenced by the
+   cache (as long as it is in the hash table and the LRU list) and by every
+   caller who got its result and hasn't released it yet. Evicting an entry
+   only drops the cache's reference, so results which are still in use stay
+   valid. */
+
+typedef struct _cacheentry {
+    unsigned int hash;
+    gfxpoly_packed_t*poly1;
+    gfxpoly_packed_t*poly2;
+    windrule_t windrule;
+    windcontext_t context;
+    char has_context;
+    gfxpoly_t*result;
+    size_t size;
+    int refs;
+    char cached;
+
+    struct _cacheentry*next; // in the hash slot
+    struct _cacheentry*newer;
+    struct _cacheentry*older;
+} cacheentry_t;
+
+struct _gfxpoly_cache {
+    pthread_mutex_t mutex;
+    cacheentry_t**slots;
+    int hashsize;
+    int num_entries;
+
+    /* least recently used entry first */
+    cacheentry_t*oldest;
+    cacheentry_t*newest;
+
+    /* results handed out -> their entries, for gfxpoly_cache_release */
+    dict_t*results;
+
+    size_t size;
+    size_t max_size;
+    long hits;
+    long misses;
+    long evictions;
+};
+
+static unsigned int hash_poly(unsigned int h, gfxpoly_t*poly)
+{
+    if (!poly)
+        return crc32_add_byte(h, 0);
+    h = crc32_add_bytes(h, &poly->gridsize, sizeof(poly->gridsize));
+    gfxsegmentlist_t*stroke;
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        h = crc32_add_bytes(h, &stroke->dir, sizeof(stroke->dir));
+        h = crc32_add_bytes(h, &stroke->fs, sizeof(stroke->fs));
+        h = crc32_add_bytes(h, &stroke->num_points, sizeof(stroke->num_points));
+        h = crc32_add_bytes(h, stroke->points, sizeof(point_t)*stroke->num_points);
+    }
+    return h;
+}
+
+static unsigned int hash_operation(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context)
+{
+    unsigned int h = hash_block((const unsigned char*)windrule, sizeof(windrule_t));
+    if (context) {
+        h = crc32_add_bytes(h, &context->user, sizeof(context->user));
+        h = crc32_add_bytes(h, &context->num_polygons, sizeof(context->num_polygons));
+    }
+    h = hash_poly(h, poly1);
+    return hash_poly(h, poly2);
+}
+
+static char packed_equals(gfxpoly_packed_t*packed, gfxpoly_t*poly)
+{
+    if (!packed || !poly)
+        return !packed && !poly;
+    if (packed->gridsize != poly->gridsize)
+        return 0;
+    gfxsegmentlist_t*stroke = poly->strokes;
+    int n;
+    for(n=0;n<packed->num_strokes;n++,stroke=stroke->next) {
+        if (!stroke)
+            return 0;
+        int num_points = packed->offsets[n+1] - packed->offsets[n];
+        if (stroke->dir != packed->dirs[n] || stroke->fs != packed->fs[n] ||
+            stroke->num_points != num_points ||
+            memcmp(stroke->points, &packed->points[packed->offsets[n]], sizeof(point_t)*num_points))
+            return 0;
+    }
+    return !stroke;
+}
+
+static size_t packed_size(gfxpoly_packed_t*packed)
+{
+    if (!packed)
+        return 0;
+    return sizeof(gfxpoly_packed_t) +
+           sizeof(point_t)*packed->num_points +
+           sizeof(int)*(packed->num_strokes+1) +
+           (sizeof(segment_dir_t)+sizeof(edgestyle_t*))*packed->num_strokes;
+}
+
+static size_t poly_size(gfxpoly_t*poly)
+{
+    return sizeof(gfxpoly_t) +
+           sizeof(gfxsegmentlist_t)*gfxpoly_num_segments(poly) +
+           sizeof(point_t)*(gfxpoly_size(poly)+gfxpoly_num_segments(poly));
+}
+
+static void entry_destroy(cacheentry_t*e)
+{
+    gfxpoly_packed_destroy(e->poly1);
+    if (e->poly2)
+        gfxpoly_packed_destroy(e->poly2);
+    gfxpoly_destroy(e->result);
+    free(e);
+}
+
+static void cache_rehash(gfxpoly_cache_t*cache, int hashsize)
+{
+    cacheentry_t**slots = (cacheentry_t**)calloc(hashsize, sizeof(cacheentry_t*));
+    int t;
+    for(t=0;t<cache->hashsize;t++) {
+        cacheentry_t*e = cache->slots[t];
+        while (e) {
+            cacheentry_t*next = e->next;
+            e->next = slots[e->hash%hashsize];
+            slots[e->hash%hashsize] = e;
+            e = next;
+        }
+    }
+    free(cache->slots);
+    cache->slots = slots;
+    cache->hashsize = hashsize;
+}
+
+static void lru_unlink(gfxpoly_cache_t*cache, cacheentry_t*e)
+{
+    if (e->older)
+        e->older->newer = e->newer;
+    else
+        cache->oldest = e->newer;
+    if (e->newer)
+        e->newer->older = e->older;
+    else
+        cache->newest = e->older;
+    e->newer = e->older = 0;
+}
+
+static void lru_append(gfxpoly_cache_t*cache, cacheentry_t*e)
+{
+    e->older = cache->newest;
+    e->newer = 0;
+    if (cache->newest)
+        cache->newest->newer = e;
+    else
+        cache->oldest = e;
+    cache->newest = e;
+}
+
+/* drops a reference to an entry, freeing it if it was the last one */
+static void entry_unref(gfxpoly_cache_t*cache, cacheentry_t*e)
+{
+    if (--e->refs)
+        return;
+    dict_del(cache->results, e->result);
+    entry_destroy(e);
+}
+
+static void cache_evict(gfxpoly_cache_t*cache, cacheentry_t*e)
+{
+    cacheentry_t**l = &cache->slots[e->hash%cache->hashsize];
+    while (*l != e)
+        l = &(*l)->next;
+    *l = e->next;
+    lru_unlink(cache, e);
+    e->cached = 0;
+    cache->num_entries--;
+    cache->size -= e->size;
+    cache->evictions++;
+    entry_unref(cache, e);
+}
+
+static char windrule_equals(cacheentry_t*e, windrule_t*windrule, windcontext_t*context)
+{
+    if (e->windrule.start != windrule->start || e->windrule.add != windrule->add ||
+        e->windrule.diff != windrule->diff)
+        return 0;
+    if (!context)
+        return !e->has_context;
+    return e->has_context && e->context.user == context->user &&
+           e->context.num_polygons == context->num_polygons;
+}
+
+static cacheentry_t* cache_find(gfxpoly_cache_t*cache, unsigned int hash, gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context)
+{
+    cacheentry_t*e = cache->slots[hash%cache->hashsize];
+    for(;e;e=e->next) {
+        if (e->hash == hash && windrule_equals(e, windrule, context) &&
+            packed_equals(e->poly1, poly1) && packed_equals(e->poly2, poly2))
+            return e;
+    }
+    return 0;
+}
+
+gfxpoly_cache_t* gfxpoly_cache_new(size_t max_size)
+{
+    gfxpoly_cache_t*cache = (gfxpoly_cache_t*)calloc(1, sizeof(gfxpoly_cache_t));
+    pthread_mutex_init(&cache->mutex, 0);
+    cache->hashsize = 64;
+    cache->slots = (cacheentry_t**)calloc(cache->hashsize, sizeof(cacheentry_t*));
+    cache->results = dict_new(&ptr_type);
+    cache->max_size = max_size;
+    return cache;
+}
+
+gfxpoly_t* gfxpoly_cache_process(gfxpoly_cache_t*cache, gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context)
+{
+    unsigned int hash = hash_operation(poly1, poly2, windrule, context);
+
+    pthread_mutex_lock(&cache->mutex);
+    cacheentry_t*e = cache_find(cache, hash, poly1, poly2, windrule, context);
+    if (e) {
+        cache->hits++;
+        e->refs++;
+        lru_unlink(cache, e);
+        lru_append(cache, e);
+        pthread_mutex_unlock(&cache->mutex);
+        return e->result;
+    }
+    cache->misses++;
+    pthread_mutex_unlock(&cache->mutex);
+
+    /* sweep without holding the lock. If another thread computes the same
+       result in the meantime, one of the two gets thrown away. */
+    e = (cacheentry_t*)calloc(1, sizeof(cacheentry_t));
+    e->hash = hash;
+    e->poly1 = gfxpoly_pack(poly1);
+    e->poly2 = poly2 ? gfxpoly_pack(poly2) : 0;
+    e->windrule = *windrule;
+    if (context) {
+        e->context = *context;
+        e->has_context = 1;
+    }
+    e->result = gfxpoly_process(poly1, poly2, windrule, context, 0);
+    e->size = sizeof(cacheentry_t) + packed_size(e->poly1) + packed_size(e->poly2) + poly_size(e->result);
+
+    pthread_mutex_lock(&cache->mutex);
+    cacheentry_t*other = cache_find(cache, hash, poly1, poly2, windrule, context);
+    if (other) {
+        entry_destroy(e);
+        other->refs++;
+        lru_unlink(cache, other);
+        lru_append(cache, other);
+        pthread_mutex_unlock(&cache->mutex);
+        return other->result;
+    }
+
+    /* one reference for the cache, one for the caller */
+    e->refs = 2;
+    e->cached = 1;
+    dict_put(cache->results, e->result, e);
+    if (cache->num_entries >= cache->hashsize)
+        cache_rehash(cache, cache->hashsize*2);
+    e->next = cache->slots[hash%cache->hashsize];
+    cache->slots[hash%cache->hashsize] = e;
+    lru_append(cache, e);
+    cache->num_entries++;
+    cache->size += e->size;
+
+    while (cache->size > cache->max_size && cache->oldest) {
+        cache_evict(cache, cache->oldest);
+    }
+    pthread_mutex_unlock(&cache->mutex);
+    return e->result;
+}
+
+void gfxpoly_cache_release(gfxpoly_cache_t*cache, gfxpoly_t*result)
+{
+    pthread_mutex_lock(&cache->mutex);
+    cacheentry_t*e = (cacheentry_t*)dict_lookup(cache->results, result);
+    assert(e);
+    if (e)
+        entry_unref(cache, e);
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void gfxpoly_cache_get_stats(gfxpoly_cache_t*cache, gfxpoly_cache_stats_t*stats)
+{
+    pthread_mutex_lock(&cache->mutex);
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->num_entries = cache->num_entries;
+    stats->size = cache->size;
+    pthread_mutex_unlock(&cache->mutex);
+}
+
+void gfxpoly_cache_destroy(gfxpoly_cache_t*cache)
+{
+    while (cache->oldest) {
+        cache_evict(cache, cache->oldest);
+    }
+    /* results which weren't released */
+    DICT_ITERATE_DATA(cache->results, cacheentry_t*, e) {
+        entry_destroy(e);
+    }
+    dict_destroy(cache->results);
+    free(cache->slots);
+    pthread_mutex_destroy(&cache->mutex);
+    free(cache);
+}
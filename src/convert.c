@@ -29,6 +29,11 @@ POSSIBILITY OF SUCH DAMAGE. */
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "poly.h"
 #include "convert.h"
 #include "wind.h"
@@ -83,70 +88,401 @@ static void convert_gfxline(gfxline_t*_line, polywriter_t*w, double gridsize)
     }
 }
 
-static char* readline(FILE*fi)
+/* The file is read in one go (mapped, if possible), and then split into
+   lines in place. The numbers in the common forms ("-12.5", "3e-2") are
+   parsed by hand. That's exact: the digits are collected into an integer,
+   and as long as that fits into a double's mantissa and the exponent is at
+   most 22, a single multiplication or division by an (exact) power of ten
+   rounds correctly, like strtod does. Lines with any other kind of number
+   are handed to sscanf, like all lines used to be. Large files are cut into
+   chunks at line boundaries, which are parsed in parallel into lists of
+   commands, and then replayed to the polywriter in order. */
+
+#define MAX_LINE 256
+#define PARALLEL_CHUNK_SIZE (4*1048576)
+
+typedef enum {FILEOP_NONE, FILEOP_MOVETO, FILEOP_LINETO, FILEOP_GRIDSIZE, FILEOP_INVALID, FILEOP_SSCANF} fileop_type_t;
+
+typedef struct _fileop {
+    fileop_type_t type;
+    union {
+        struct {
+            double x, y; // for gridsize, x is the gridsize
+        };
+        struct {
+            const char*line; // for invalid commands and FILEOP_SSCANF
+            int len;
+        };
+    };
+} fileop_t;
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static inline char is_space(char c)
 {
-    /* FIXME: Rather than reading the file byte by byte, we should really use
-       buffers or mmap */
-    char c;
-    while (1) {
-        int l = fread(&c, 1, 1, fi);
-        if (!l)
+    return c==' ' || c=='\t' || c=='\v' || c=='\f';
+}
+
+/* returns 1 if a number was parsed, 0 if there is no number (in which case
+   sscanf wouldn't find one either), and -1 if sscanf needs to decide */
+static int parse_number(const char**_p, const char*end, double*value)
+{
+    const char*p = *_p;
+    while (p<end && is_space(*p))
+        p++;
+    if (p==end)
+        return 0;
+    const char*start = p;
+    char negative = 0;
+    if (*p=='-' || *p=='+') {
+        negative = *p=='-';
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    char seen_digit = 0;
+    while (p<end && *p>='0' && *p<='9') {
+        seen_digit = 1;
+        if (mantissa || *p!='0') {
+            if (++digits > 18)
+                return -1;
+            mantissa = mantissa*10 + (*p-'0');
+        }
+        p++;
+    }
+    if (p<end && *p=='.') {
+        p++;
+        while (p<end && *p>='0' && *p<='9') {
+            seen_digit = 1;
+            if (mantissa || *p!='0') {
+                if (++digits > 18)
+                    return -1;
+                mantissa = mantissa*10 + (*p-'0');
+            }
+            exponent--;
+            p++;
+        }
+    }
+    if (!seen_digit) {
+        /* words (other than "inf" and "nan") aren't numbers, for anything
+           else (".", "-" etc.) we let sscanf decide */
+        char c = *start;
+        if ((c>='a' && c<='z' && c!='i' && c!='n') ||
+            (c>='A' && c<='Z' && c!='I' && c!='N') || c=='%')
             return 0;
-        if (c!=10 || c!=13)
-            break;
-    }
-    char line[256];
-    int pos = 0;
-    while (1) {
-        if (pos<sizeof(line)-2) {
-            line[pos++] = c;
-            line[pos] = 0;
+        return -1;
+    }
+    if (p<end && (*p=='e' || *p=='E')) {
+        p++;
+        char negative_exponent = 0;
+        if (p<end && (*p=='-' || *p=='+')) {
+            negative_exponent = *p=='-';
+            p++;
+        }
+        if (p==end || *p<'0' || *p>'9')
+            return -1;
+        int e = 0;
+        while (p<end && *p>='0' && *p<='9') {
+            if (e < 10000)
+                e = e*10 + (*p-'0');
+            p++;
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+    if (p<end && ((*p>='a' && *p<='z') || (*p>='A' && *p<='Z')) && *p!='m' && *p!='l') {
+        /* e.g. hex numbers. Letters which start a command are fine,
+           sscanf stops in front of them, too. */
+        return -1;
+    }
+    double v;
+    if (mantissa > ((uint64_t)1<<53)) {
+        return -1;
+    } else if (!mantissa) {
+        v = 0;
+    } else if (exponent >= 0 && exponent <= 22) {
+        v = (double)mantissa * powers_of_ten[exponent];
+    } else if (exponent < 0 && exponent >= -22) {
+        v = (double)mantissa / powers_of_ten[-exponent];
+    } else {
+        return -1;
+    }
+    *value = negative ? -v : v;
+    *_p = p;
+    return 1;
+}
+
+static inline char match_word(const char*p, const char*end, const char*word, int len)
+{
+    return end-p == len && !memcmp(p, word, len);
+}
+
+static void parse_line(const char*line, const char*end, fileop_t*op)
+{
+    const char*p = line;
+    op->type = FILEOP_NONE;
+    while (p<end && is_space(*p))
+        p++;
+    if (p==end)
+        return;
+    int r;
+    if (*p == '%') {
+        /* "% gridsize <g>" */
+        p++;
+        while (p<end && is_space(*p))
+            p++;
+        if (end-p < 8 || memcmp(p, "gridsize", 8))
+            return;
+        p += 8;
+        r = parse_number(&p, end, &op->x);
+        if (r > 0)
+            op->type = FILEOP_GRIDSIZE;
+        else if (r < 0)
+            op->type = FILEOP_SSCANF;
+        goto done;
+    }
+
+    /* "<x> <y> <command>" */
+    r = parse_number(&p, end, &op->x);
+    if (r > 0)
+        r = parse_number(&p, end, &op->y);
+    if (r < 0) {
+        op->type = FILEOP_SSCANF;
+        goto done;
+    }
+    if (!r)
+        return;
+    while (p<end && is_space(*p))
+        p++;
+    const char*word = p;
+    while (p<end && !is_space(*p))
+        p++;
+    if (p==word) {
+        return;
+    } else if (match_word(word, p, "moveto", 6)) {
+        op->type = FILEOP_MOVETO;
+    } else if (match_word(word, p, "lineto", 6)) {
+        op->type = FILEOP_LINETO;
+    } else {
+        op->type = FILEOP_INVALID;
+        op->line = word;
+        op->len = p-word;
+    }
+    return;
+done:
+    if (op->type == FILEOP_SSCANF) {
+        op->line = line;
+        op->len = end-line;
+    }
+}
+
+/* the old way of parsing a line, for the numbers parse_number doesn't
+   handle */
+static void parse_line_sscanf(const char*line, int len, fileop_t*op)
+{
+    char buf[MAX_LINE];
+    if (len > MAX_LINE-2)
+        len = MAX_LINE-2;
+    memcpy(buf, line, len);
+    buf[len] = 0;
+
+    double x,y,g;
+    char s[MAX_LINE];
+    op->type = FILEOP_NONE;
+    if (sscanf(buf, "%lf %lf %s", &x, &y, (char*)&s) == 3) {
+        if (!strcmp(s,"moveto")) {
+            op->type = FILEOP_MOVETO;
+        } else if (!strcmp(s,"lineto")) {
+            op->type = FILEOP_LINETO;
+        } else {
+            fprintf(stderr, "invalid command: %s\n", s);
+            return;
+        }
+        op->x = x;
+        op->y = y;
+    } else if (sscanf(buf, "%% gridsize %lf", &g) == 1) {
+        op->type = FILEOP_GRIDSIZE;
+        op->x = g;
+    }
+}
+
+typedef struct _fileparser {
+    polywriter_t*w;
+    double gridsize;
+    double z;
+    int count;
+    double g;
+} fileparser_t;
+
+static void apply_op(fileparser_t*f, fileop_t*op)
+{
+    if (op->type == FILEOP_SSCANF)
+        parse_line_sscanf(op->line, op->len, op);
+    switch (op->type) {
+        case FILEOP_MOVETO:
+            f->w->moveto(f->w, convert_coord(op->x,f->z), convert_coord(op->y,f->z));
+            f->count++;
+        break;
+        case FILEOP_LINETO:
+            f->w->lineto(f->w, convert_coord(op->x,f->z), convert_coord(op->y,f->z));
+            f->count++;
+        break;
+        case FILEOP_GRIDSIZE:
+            f->g = f->gridsize = op->x;
+            f->z = 1.0 / f->gridsize;
+            f->w->setgridsize(f->w, f->g);
+        break;
+        case FILEOP_INVALID:
+            fprintf(stderr, "invalid command: %.*s\n", op->len, op->line);
+        break;
+        default:
+        break;
+    }
+}
+
+static inline const char* line_end(const char*p, const char*end)
+{
+    const char*nl = memchr(p, '\n', end-p);
+    const char*eol = nl ? nl : end;
+    const char*cr = memchr(p, '\r', eol-p);
+    return cr ? cr : eol;
+}
+
+typedef struct _chunk {
+    const char*start;
+    const char*end;
+    fileop_t*ops;
+    int num_ops;
+    int ops_size;
+} chunk_t;
+
+static void* parse_chunk(void*_chunk)
+{
+    chunk_t*c = (chunk_t*)_chunk;
+    const char*p = c->start;
+    while (p < c->end) {
+        const char*eol = line_end(p, c->end);
+        if (c->num_ops == c->ops_size) {
+            c->ops_size = c->ops_size ? c->ops_size*2 : 1024;
+            c->ops = (fileop_t*)realloc(c->ops, sizeof(fileop_t)*c->ops_size);
         }
-        int l = fread(&c, 1, 1, fi);
-        if (!l || c==10 || c==13) {
-            return strdup(line);
+        fileop_t*op = &c->ops[c->num_ops];
+        parse_line(p, eol, op);
+        if (op->type != FILEOP_NONE)
+            c->num_ops++;
+        p = eol+1;
+    }
+    return 0;
+}
+
+static void parse_buffer(fileparser_t*f, const char*data, size_t size)
+{
+    const char*end = data + size;
+    int num_chunks = 1;
+    if (size >= 2*PARALLEL_CHUNK_SIZE) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_chunks = cpus > 0 ? (int)cpus : 1;
+        if (num_chunks > size / PARALLEL_CHUNK_SIZE)
+            num_chunks = size / PARALLEL_CHUNK_SIZE;
+    }
+    if (num_chunks <= 1) {
+        const char*p = data;
+        while (p < end) {
+            const char*eol = line_end(p, end);
+            fileop_t op;
+            parse_line(p, eol, &op);
+            apply_op(f, &op);
+            p = eol+1;
         }
+        return;
+    }
+
+    chunk_t*chunks = (chunk_t*)calloc(num_chunks, sizeof(chunk_t));
+    pthread_t*threads = (pthread_t*)malloc(sizeof(pthread_t)*num_chunks);
+    const char*p = data;
+    int t;
+    for(t=0;t<num_chunks;t++) {
+        chunks[t].start = p;
+        if (t == num_chunks-1) {
+            p = end;
+        } else {
+            /* cut after the line break following the ideal position */
+            p = data + size / num_chunks * (t+1);
+            if (p < chunks[t].start)
+                p = chunks[t].start;
+            const char*nl = memchr(p, '\n', end-p);
+            p = nl ? nl+1 : end;
+        }
+        chunks[t].end = p;
     }
+    /* chunk 0 is done by the calling thread */
+    char*started = (char*)calloc(num_chunks, 1);
+    for(t=1;t<num_chunks;t++) {
+        started[t] = !pthread_create(&threads[t], 0, parse_chunk, &chunks[t]);
+    }
+    parse_chunk(&chunks[0]);
+    for(t=0;t<num_chunks;t++) {
+        if (started[t])
+            pthread_join(threads[t], 0);
+        else if (t)
+            parse_chunk(&chunks[t]);
+        int i;
+        for(i=0;i<chunks[t].num_ops;i++) {
+            apply_op(f, &chunks[t].ops[i]);
+        }
+        free(chunks[t].ops);
+    }
+    free(started);
+    free(threads);
+    free(chunks);
 }
 
 static void convert_file(const char*filename, polywriter_t*w, double gridsize)
 {
-    FILE*fi = fopen(filename, "rb");
-    if (!fi) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0) {
         perror(filename);
+        if (fd >= 0)
+            close(fd);
         return;
     }
-    double z = 1.0 / gridsize;
-    int count = 0;
-    double g = 0;
-    while (1) {
-        char*line = readline(fi);
-        if (!line)
-            break;
-        double x,y;
-        char s[256];
-        if (sscanf(line, "%lf %lf %s", &x, &y, (char*)&s) == 3) {
-            if (!strcmp(s,"moveto")) {
-                w->moveto(w, convert_coord(x,z), convert_coord(y,z));
-                count++;
-            } else if (!strcmp(s,"lineto")) {
-                w->lineto(w, convert_coord(x,z), convert_coord(y,z));
-                count++;
-            } else {
-                fprintf(stderr, "invalid command: %s\n", s);
+    size_t size = st.st_size;
+    char*data = size ? mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0) : 0;
+    char mapped = data && data != MAP_FAILED;
+    if (!mapped) {
+        /* e.g. a pipe */
+        size_t data_size = 65536;
+        data = malloc(data_size);
+        size = 0;
+        int l;
+        while ((l = read(fd, data+size, data_size-size)) > 0) {
+            size += l;
+            if (size == data_size) {
+                data_size *= 2;
+                data = realloc(data, data_size);
             }
-        } else if (sscanf(line, "%% gridsize %lf", &g) == 1) {
-            gridsize = g;
-            z = 1.0 / gridsize;
-            w->setgridsize(w, g);
         }
-        free(line);
     }
-    fclose(fi);
-    if (g) {
-        fprintf(stderr, "loaded %d points from %s (gridsize %f)\n", count, filename, g);
+    close(fd);
+
+    fileparser_t f;
+    f.w = w;
+    f.gridsize = gridsize;
+    f.z = 1.0 / gridsize;
+    f.count = 0;
+    f.g = 0;
+    parse_buffer(&f, data, size);
+
+    if (mapped)
+        munmap(data, size);
+    else
+        free(data);
+    if (f.g) {
+        fprintf(stderr, "loaded %d points from %s (gridsize %f)\n", f.count, filename, f.g);
     } else {
-        fprintf(stderr, "loaded %d points from %s\n", count, filename);
+        fprintf(stderr, "loaded %d points from %s\n", f.count, filename);
     }
 }
 
@@ -318,6 +654,236 @@ void gfxpoly_destroy(gfxpoly_t*poly)
     free(poly);
 }
 
+gfxpoly_packed_t* gfxpoly_packed_new(double gridsize, int num_strokes, int num_points)
+{
+    /* pointers first, so that everything stays aligned */
+    gfxpoly_packed_t*p = (gfxpoly_packed_t*)malloc(sizeof(gfxpoly_packed_t) +
+                                                   sizeof(edgestyle_t*)*num_strokes +
+                                                   sizeof(point_t)*num_points +
+                                                   sizeof(int)*(num_strokes+1) +
+                                                   sizeof(segment_dir_t)*num_strokes);
+    p->gridsize = gridsize;
+    p->num_strokes = num_strokes;
+    p->num_points = num_points;
+    p->fs = (edgestyle_t**)&p[1];
+    p->points = (point_t*)&p->fs[num_strokes];
+    p->offsets = (int*)&p->points[num_points];
+    p->dirs = (segment_dir_t*)&p->offsets[num_strokes+1];
+    p->offsets[num_strokes] = num_points;
+    p->mapping = 0;
+    p->mapping_size = 0;
+    return p;
+}
+
+void gfxpoly_packed_destroy(gfxpoly_packed_t*poly)
+{
+    if (poly->mapping)
+        munmap(poly->mapping, poly->mapping_size);
+    free(poly);
+}
+
+gfxpoly_packed_t* gfxpoly_pack(gfxpoly_t*poly)
+{
+    int num_strokes = 0, num_points = 0;
+    gfxsegmentlist_t*stroke;
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        num_strokes++;
+        num_points += stroke->num_points;
+    }
+    gfxpoly_packed_t*p = gfxpoly_packed_new(poly->gridsize, num_strokes, num_points);
+    int n = 0, pos = 0;
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        p->offsets[n] = pos;
+        p->dirs[n] = stroke->dir;
+        p->fs[n] = stroke->fs;
+        memcpy(&p->points[pos], stroke->points, sizeof(point_t)*stroke->num_points);
+        pos += stroke->num_points;
+        n++;
+    }
+    return p;
+}
+
+gfxpoly_t* gfxpoly_unpack(gfxpoly_packed_t*packed)
+{
+    gfxpoly_t*poly = (gfxpoly_t*)malloc(sizeof(gfxpoly_t));
+    poly->gridsize = packed->gridsize;
+    gfxsegmentlist_t**last = &poly->strokes;
+    int t;
+    for(t=0;t<packed->num_strokes;t++) {
+        int num_points = packed->offsets[t+1] - packed->offsets[t];
+        gfxsegmentlist_t*s = (gfxsegmentlist_t*)malloc(sizeof(gfxsegmentlist_t));
+        s->dir = packed->dirs[t];
+        s->fs = packed->fs[t];
+        s->num_points = s->points_size = num_points;
+        s->points = (point_t*)malloc(sizeof(point_t)*num_points);
+        memcpy(s->points, &packed->points[packed->offsets[t]], sizeof(point_t)*num_points);
+        *last = s;
+        last = &s->next;
+    }
+    *last = 0;
+    return poly;
+}
+
+/* like the compactpoly writer, but collects the points of all strokes in
+   one buffer. The points of the stroke currently being drawn are the ones
+   after start. */
+typedef struct _packedpoly {
+    double gridsize;
+    point_t*points;
+    int num_points;
+    int points_size;
+    int*offsets;
+    segment_dir_t*dirs;
+    edgestyle_t**styles;
+    int num_strokes;
+    int strokes_size;
+    int start;
+    void*fs;
+    point_t last;
+    segment_dir_t dir;
+    char new;
+} packedpoly_t;
+
+static void packed_finish_stroke(packedpoly_t*data)
+{
+    int num = data->num_points - data->start;
+    if (num <= 1) {
+        data->num_points = data->start;
+        return;
+    }
+    assert(data->dir != DIR_UNKNOWN);
+    if (data->dir == DIR_UP) {
+        point_t*p = &data->points[data->start];
+        int t;
+        for(t=0;t<num/2;t++) {
+            point_t tmp = p[t];
+            p[t] = p[num-1-t];
+            p[num-1-t] = tmp;
+        }
+    }
+    if (data->num_strokes == data->strokes_size) {
+        data->strokes_size = data->strokes_size ? data->strokes_size*2 : 16;
+        data->offsets = (int*)realloc(data->offsets, sizeof(int)*data->strokes_size);
+        data->dirs = (segment_dir_t*)realloc(data->dirs, sizeof(segment_dir_t)*data->strokes_size);
+        data->styles = (edgestyle_t**)realloc(data->styles, sizeof(edgestyle_t*)*data->strokes_size);
+    }
+    data->offsets[data->num_strokes] = data->start;
+    data->dirs[data->num_strokes] = data->dir;
+    data->styles[data->num_strokes] = data->fs;
+    data->num_strokes++;
+    data->start = data->num_points;
+}
+
+static void packed_add_point(packedpoly_t*data, point_t p)
+{
+    if (data->num_points == data->points_size) {
+        data->points_size = data->points_size ? data->points_size*2 : 64;
+        data->points = (point_t*)realloc(data->points, sizeof(point_t)*data->points_size);
+    }
+    data->points[data->num_points++] = p;
+}
+
+static void packedsetedgestyle(polywriter_t*w, void*fs)
+{
+    packedpoly_t*data = (packedpoly_t*)w->internal;
+    if (fs != data->fs) {
+        /* edgestyles are per stroke */
+        packed_finish_stroke(data);
+        data->new = 1;
+    }
+    data->fs = fs;
+}
+
+static void packedmoveto(polywriter_t*w, int32_t x, int32_t y)
+{
+    packedpoly_t*data = (packedpoly_t*)w->internal;
+    point_t p;
+    p.x = x;
+    p.y = y;
+    if (p.x != data->last.x || p.y != data->last.y) {
+        data->new = 1;
+    }
+    data->last = p;
+}
+
+static void packedlineto(polywriter_t*w, int32_t x, int32_t y)
+{
+    packedpoly_t*data = (packedpoly_t*)w->internal;
+    point_t p;
+    p.x = x;
+    p.y = y;
+
+    int diff = direction(p, data->last);
+    if (!diff)
+        return;
+    segment_dir_t dir = diff<0?DIR_UP:DIR_DOWN;
+
+    if (dir!=data->dir || data->new) {
+        packed_finish_stroke(data);
+        data->dir = dir;
+        packed_add_point(data, data->last);
+    }
+    data->new = 0;
+    packed_add_point(data, p);
+    data->last = p;
+}
+
+static void packedsetgridsize(polywriter_t*w, double gridsize)
+{
+    packedpoly_t*data = (packedpoly_t*)w->internal;
+    data->gridsize = gridsize;
+}
+
+static void*packedfinish(polywriter_t*w)
+{
+    packedpoly_t*data = (packedpoly_t*)w->internal;
+    packed_finish_stroke(data);
+    gfxpoly_packed_t*p = gfxpoly_packed_new(data->gridsize, data->num_strokes, data->num_points);
+    memcpy(p->points, data->points, sizeof(point_t)*data->num_points);
+    memcpy(p->offsets, data->offsets, sizeof(int)*data->num_strokes);
+    memcpy(p->dirs, data->dirs, sizeof(segment_dir_t)*data->num_strokes);
+    memcpy(p->fs, data->styles, sizeof(edgestyle_t*)*data->num_strokes);
+    free(data->points);
+    free(data->offsets);
+    free(data->dirs);
+    free(data->styles);
+    free(w->internal);w->internal = 0;
+    return (void*)p;
+}
+
+void gfxpackedwriter_init(polywriter_t*w)
+{
+    w->setedgestyle = packedsetedgestyle;
+    w->moveto = packedmoveto;
+    w->lineto = packedlineto;
+    w->setgridsize = packedsetgridsize;
+    w->finish = packedfinish;
+    packedpoly_t*data = w->internal = calloc(1,sizeof(packedpoly_t));
+    data->gridsize = 1.0;
+    data->new = 1;
+    data->dir = DIR_UNKNOWN;
+    data->fs = &edgestyle_default;
+}
+
+gfxpoly_packed_t* gfxpoly_packed_from_fill(gfxline_t*line, double gridsize)
+{
+    polywriter_t writer;
+    gfxpackedwriter_init(&writer);
+    writer.setgridsize(&writer, gridsize);
+    convert_gfxline(line, &writer, gridsize);
+    return (gfxpoly_packed_t*)writer.finish(&writer);
+}
+
+gfxpoly_packed_t* gfxpoly_packed_from_file(const char*filename)
+{
+    polywriter_t writer;
+    gfxpackedwriter_init(&writer);
+    double default_gridsize = 1.0;
+    writer.setgridsize(&writer, default_gridsize);
+    convert_file(filename, &writer, default_gridsize);
+    return (gfxpoly_packed_t*)writer.finish(&writer);
+}
+
 typedef struct _polydraw_internal
 {
     double lx, ly;
@@ -549,6 +1115,36 @@ gfxline_t*gfxline_from_gfxpoly_with_direction(gfxpoly_t*poly)
     return gfxline_rewind(mkgfxline(poly, 1));
 }
 
+gfxline_t*gfxline_from_gfxpoly_packed(gfxpoly_packed_t*poly)
+{
+    point_t last = {INVALID_COORD, INVALID_COORD};
+    gfxline_t*l = gfxline_new();
+    int s;
+    for(s=0;s<poly->num_strokes;s++) {
+        point_t*points = &poly->points[poly->offsets[s]];
+        int num = poly->offsets[s+1] - poly->offsets[s];
+        int pos = 0;
+        int incr = 1;
+        if (poly->dirs[s] == DIR_UP) {
+            pos = num-1;
+            incr = -1;
+        }
+        if (last.x != points[pos].x || last.y != points[pos].y) {
+            l = gfxline_moveTo(l, points[pos].x * poly->gridsize,
+                              points[pos].y * poly->gridsize);
+        }
+        pos += incr;
+        int t;
+        for(t=1;t<num;t++) {
+            l = gfxline_lineTo(l, points[pos].x * poly->gridsize,
+                              points[pos].y * poly->gridsize);
+            pos += incr;
+        }
+        last = points[pos-incr];
+    }
+    return gfxline_rewind(l);
+}
+
 gfxline_t* gfxpoly_circular_to_evenodd(gfxline_t*line, double gridsize)
 {
     gfxpoly_t*poly = gfxpoly_from_fill(line, gridsize);
@@ -47,4 +47,6 @@ void gfxpolywriter_init(polywriter_t*w);
 gfxpoly_t* gfxpoly_from_fill(gfxline_t*line, double gridsize);
 gfxpoly_t* gfxpoly_from_file(const char*filename);
 
+void gfxpackedwriter_init(polywriter_t*w);
+
 #endif //__poly_convert_h__
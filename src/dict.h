@@ -32,6 +32,11 @@ POSSIBILITY OF SUCH DAMAGE. */
 #include <stdio.h>
 #include <stdbool.h>
 
+unsigned int crc32_add_byte(unsigned int checksum, unsigned char b);
+unsigned int crc32_add_string(unsigned int checksum, const char*s);
+unsigned int crc32_add_bytes(unsigned int checksum, const void*s, int len);
+unsigned int hash_block(const unsigned char*data, int len);
+
 typedef bool (*equals_func)(const void*o1, const void*o2);
 typedef unsigned int (*hash_func)(const void*o);
 typedef void* (*dup_func)(const void*o);
@@ -0,0 +1,309 @@
+/* expr.c
+
+Boolean expressions over many polygons, evaluated in a single sweep
+
+Copyright (c) 2012 Matthias Kramm <kramm@quiss.org>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE. */
+
+
+#include <stdlib.h>
+#include <memory.h>
+#include "gfxpoly.h"
+#include "poly.h"
+#include "dict.h"
+
+/* Expressions are compiled into postfix code for a small stack machine.
+   Codes below EXPR_NOT push the inside bit of that operand. */
+#define MAX_OPERANDS 64
+#define EXPR_NOT 64
+#define EXPR_AND 65
+#define EXPR_OR 66
+#define EXPR_SUB 67
+#define EXPR_XOR 68
+
+/* expressions over at most this many operands get a truth table */
+#define TABLE_BITS 12
+
+/* The set of operands a point is inside of doesn't fit into a windstate_t,
+   so the windrule keeps one exprstate_t per set it has come across, and
+   points windstate_t.user to it. */
+typedef struct _exprstate {
+    uint64_t inside; // bit n: inside operand n
+    char is_filled;
+    struct _exprstate**next; // the state after crossing an edge of operand n, if known
+} exprstate_t;
+
+struct _gfxpoly_expr {
+    unsigned char*code;
+    int size;
+    int code_size;
+    int depth;
+    int max_depth;
+    int num_operands; // highest operand index + 1
+    char*table;
+    windcontext_t context;
+    dict_t*states; // inside -> exprstate_t
+    exprstate_t*outside;
+};
+
+typedef struct _parser {
+    const char*s;
+    gfxpoly_expr_t*expr;
+    char error;
+} parser_t;
+
+static void emit(parser_t*p, unsigned char code)
+{
+    gfxpoly_expr_t*e = p->expr;
+    if (e->size == e->code_size) {
+        e->code_size = e->code_size ? e->code_size*2 : 16;
+        e->code = (unsigned char*)realloc(e->code, e->code_size);
+    }
+    e->code[e->size++] = code;
+    if (code < EXPR_NOT) {
+        if (++e->depth > e->max_depth)
+            e->max_depth = e->depth;
+    } else if (code != EXPR_NOT) {
+        e->depth--;
+    }
+}
+
+static char peek(parser_t*p)
+{
+    while (*p->s == ' ' || *p->s == '\t' || *p->s == '\n')
+        p->s++;
+    return *p->s;
+}
+
+static void parse_or(parser_t*p);
+
+static void parse_factor(parser_t*p)
+{
+    char c = peek(p);
+    if (c == '!' || c == '~') {
+        p->s++;
+        parse_factor(p);
+        emit(p, EXPR_NOT);
+    } else if (c == '(') {
+        p->s++;
+        parse_or(p);
+        if (peek(p) != ')') {
+            p->error = 1;
+            return;
+        }
+        p->s++;
+    } else if (c >= '0' && c <= '9') {
+        int nr = 0;
+        while (*p->s >= '0' && *p->s <= '9' && nr < MAX_OPERANDS) {
+            nr = nr*10 + (*p->s++ - '0');
+        }
+        if (nr >= MAX_OPERANDS) {
+            p->error = 1;
+            return;
+        }
+        if (nr >= p->expr->num_operands)
+            p->expr->num_operands = nr+1;
+        emit(p, nr);
+    } else {
+        p->error = 1;
+    }
+}
+
+static void parse_and(parser_t*p)
+{
+    parse_factor(p);
+    while (!p->error && peek(p) == '&') {
+        p->s++;
+        parse_factor(p);
+        emit(p, EXPR_AND);
+    }
+}
+
+static void parse_or(parser_t*p)
+{
+    parse_and(p);
+    while (!p->error) {
+        unsigned char op;
+        switch (peek(p)) {
+            case '|': op = EXPR_OR; break;
+            case '-': op = EXPR_SUB; break;
+            case '^': op = EXPR_XOR; break;
+            default: return;
+        }
+        p->s++;
+        parse_and(p);
+        emit(p, op);
+    }
+}
+
+static char expr_run(gfxpoly_expr_t*e, uint64_t inside)
+{
+    char stack[e->max_depth];
+    int sp = 0, t;
+    for (t=0;t<e->size;t++) {
+        unsigned char c = e->code[t];
+        switch (c) {
+            case EXPR_NOT: stack[sp-1] ^= 1; break;
+            case EXPR_AND: sp--; stack[sp-1] &= stack[sp]; break;
+            case EXPR_OR:  sp--; stack[sp-1] |= stack[sp]; break;
+            case EXPR_SUB: sp--; stack[sp-1] &= !stack[sp]; break;
+            case EXPR_XOR: sp--; stack[sp-1] ^= stack[sp]; break;
+            default:
+                stack[sp++] = (inside >> c) & 1;
+        }
+    }
+    assert(sp == 1);
+    return stack[0];
+}
+
+static inline char expr_eval(gfxpoly_expr_t*e, uint64_t inside)
+{
+    if (e->table)
+        return e->table[inside];
+    return expr_run(e, inside);
+}
+
+static bool inside_equals(const void*o1, const void*o2)
+{
+    return *(const uint64_t*)o1 == *(const uint64_t*)o2;
+}
+static unsigned int inside_hash(const void*o)
+{
+    uint64_t inside = *(const uint64_t*)o;
+    return (unsigned int)(inside ^ (inside >> 32)) * 2654435761u;
+}
+/* the keys are the inside fields of the states */
+static void* inside_dup(const void*o)
+{
+    return (void*)o;
+}
+static void inside_free(void*o)
+{
+}
+static type_t inside_type = {
+    equals: inside_equals,
+    hash: inside_hash,
+    dup: inside_dup,
+    free: inside_free,
+};
+
+static exprstate_t* expr_state(gfxpoly_expr_t*e, uint64_t inside)
+{
+    exprstate_t*state = (exprstate_t*)dict_lookup(e->states, &inside);
+    if (!state) {
+        state = (exprstate_t*)malloc(sizeof(exprstate_t));
+        state->inside = inside;
+        state->is_filled = expr_eval(e, inside);
+        state->next = (exprstate_t**)calloc(e->num_operands, sizeof(exprstate_t*));
+        dict_put(e->states, &state->inside, state);
+    }
+    return state;
+}
+
+gfxpoly_expr_t* gfxpoly_expr_new(const char*s)
+{
+    gfxpoly_expr_t*e = (gfxpoly_expr_t*)calloc(1, sizeof(gfxpoly_expr_t));
+    parser_t p = {s, e, 0};
+    parse_or(&p);
+    if (p.error || peek(&p) || expr_run(e, 0)) {
+        /* a syntax error, or an expression which is true outside of all
+           polygons (which would make the result infinite) */
+        gfxpoly_expr_destroy(e);
+        return 0;
+    }
+    if (e->num_operands <= TABLE_BITS) {
+        uint64_t t, num = (uint64_t)1 << e->num_operands;
+        e->table = (char*)malloc(num);
+        for (t=0;t<num;t++) {
+            e->table[t] = expr_run(e, t);
+        }
+    }
+    e->context.user = e;
+    e->context.num_polygons = e->num_operands;
+    e->states = dict_new(&inside_type);
+    e->outside = expr_state(e, 0);
+    return e;
+}
+
+void gfxpoly_expr_destroy(gfxpoly_expr_t*e)
+{
+    if (e->states) {
+        DICT_ITERATE_DATA(e->states, exprstate_t*, state) {
+            free(state->next);
+            free(state);
+        }
+        dict_destroy(e->states);
+    }
+    free(e->code);
+    free(e->table);
+    free(e);
+}
+
+// -------------------- windrule ----------------------
+
+static windstate_t expr_start(windcontext_t*context)
+{
+    gfxpoly_expr_t*e = (gfxpoly_expr_t*)context->user;
+    windstate_t w;
+    memset(&w, 0, sizeof(w));
+    w.user = e->outside;
+    return w;
+}
+
+static windstate_t expr_add(windcontext_t*context, windstate_t left, edgestyle_t*edge, segment_dir_t dir, int master)
+{
+    gfxpoly_expr_t*e = (gfxpoly_expr_t*)context->user;
+    assert(master < e->num_operands);
+    exprstate_t*state = left.user ? (exprstate_t*)left.user : e->outside;
+    exprstate_t*next = state->next[master];
+    if (!next) {
+        next = state->next[master] = expr_state(e, state->inside ^ ((uint64_t)1 << master));
+    }
+    left.user = next;
+    left.is_filled = next->is_filled;
+    return left;
+}
+
+static edgestyle_t* expr_diff(windcontext_t*context, windstate_t*left, windstate_t*right)
+{
+    if (left->is_filled==right->is_filled)
+        return 0;
+    else
+        return &edgestyle_default;
+}
+
+static windrule_t windrule_expr = {
+    start: expr_start,
+    add: expr_add,
+    diff: expr_diff,
+};
+
+gfxpoly_t* gfxpoly_expr_evaluate(gfxpoly_expr_t*e, gfxpoly_t**polys, int num)
+{
+    if (num < e->num_operands)
+        return 0;
+    /* operands after the last one the expression mentions don't need to be
+       swept */
+    return gfxpoly_process_many(polys, e->num_operands, &windrule_expr, &e->context, NULL);
+}
@@ -80,3 +80,72 @@ static void name##_destroy(name##_t*h)                                 \
 {                                                                      \
     free((h)->elements);                                               \
 }
+
+/* Like HEAP_DEFINE, but stores the elements themselves instead of pointers
+   to them, so that comparisons don't need to chase pointers. It's a 4-ary
+   heap: that makes the tree half as deep, and the four children of a node
+   are adjacent in memory.
+   Pointers returned by name_peek() are only valid until the next put/get. */
+#define HEAP_DEFINE_INLINE(name,t,lt)                                  \
+typedef struct {                                                       \
+    t*elements;                                                        \
+    int size;                                                          \
+    int max_size;                                                      \
+} name##_t;                                                            \
+static void name##_put(name##_t*h, t*e)                                \
+{                                                                      \
+    if (h->size == h->max_size) {                                      \
+        h->max_size = h->max_size<16?16:h->max_size*2;                 \
+        h->elements = (t*)realloc(h->elements,                         \
+                                  h->max_size*sizeof(t));              \
+    }                                                                  \
+    int node = h->size++;                                              \
+    while (node) {                                                     \
+        int parent = (node-1)>>2;                                      \
+        if (!lt(e, &h->elements[parent]))                              \
+            break;                                                     \
+        h->elements[node] = h->elements[parent];                       \
+        node = parent;                                                 \
+    }                                                                  \
+    h->elements[node] = *e;                                            \
+}                                                                      \
+static inline t* name##_peek(name##_t*h)                               \
+{                                                                      \
+    return h->size ? &h->elements[0] : 0;                              \
+}                                                                      \
+static char name##_get(name##_t*h, t*r)                                \
+{                                                                      \
+    if (!h->size) return 0;                                            \
+    *r = h->elements[0];                                               \
+    t*last = &h->elements[--h->size];                                  \
+    int node = 0;                                                      \
+    while (1) {                                                        \
+        int child = (node<<2)+1;                                       \
+        if (child >= h->size)                                          \
+            break;                                                     \
+        int end = child+4 < h->size ? child+4 : h->size;               \
+        int best = child, c;                                           \
+        for(c=child+1;c<end;c++) {                                     \
+            if (lt(&h->elements[c], &h->elements[best]))               \
+                best = c;                                              \
+        }                                                              \
+        if (!lt(&h->elements[best], last))                             \
+            break;                                                     \
+        h->elements[node] = h->elements[best];                         \
+        node = best;                                                   \
+    }                                                                  \
+    h->elements[node] = *last;                                         \
+    return 1;                                                          \
+}                                                                      \
+static void name##_init(name##_t*h)                                    \
+{                                                                      \
+    memset(h, 0, sizeof(*h));                                          \
+}                                                                      \
+static inline void name##_clear(name##_t*h)                          \
+{                                                                      \
+    h->size = 0;                                                       \
+}                                                                      \
+static void name##_destroy(name##_t*h)                                 \
+{                                                                      \
+    free((h)->elements);                                               \
+}
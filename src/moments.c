@@ -90,25 +90,24 @@ void moments_normalize(moments_t*moments, double gridsize)
 double gfxpoly_area(gfxpoly_t*p)
 {
     moments_t moments;
-    gfxpoly_t*p2 = gfxpoly_process(p, 0, &windrule_evenodd, &onepolygon, &moments);
-    gfxpoly_destroy(p2);
-    moments_normalize(&moments, p->gridsize);
+    gfxpoly_measure(p, 0, &windrule_evenodd, &onepolygon, &moments, 0);
     return moments.area;
 }
+double gfxpoly_perimeter(gfxpoly_t*p)
+{
+    double perimeter;
+    gfxpoly_measure(p, 0, &windrule_evenodd, &onepolygon, 0, &perimeter);
+    return perimeter;
+}
 double gfxpoly_intersection_area(gfxpoly_t*p1, gfxpoly_t*p2)
 {
     moments_t moments;
-    gfxpoly_t*p3 = gfxpoly_process(p1, p2, &windrule_intersect, &twopolygons, &moments);
-    gfxpoly_destroy(p3);
-
-    moments_normalize(&moments, p1->gridsize);
+    gfxpoly_measure(p1, p2, &windrule_intersect, &twopolygons, &moments, 0);
     return moments.area;
 }
 moments_t gfxpoly_moments(gfxpoly_t*p)
 {
     moments_t moments;
-    gfxpoly_t*p2 = gfxpoly_process(p, 0, &windrule_evenodd, &onepolygon, &moments);
-    gfxpoly_destroy(p2);
-    moments_normalize(&moments, p->gridsize);
+    gfxpoly_measure(p, 0, &windrule_evenodd, &onepolygon, &moments, 0);
     return moments;
 }
@@ -31,13 +31,18 @@ POSSIBILITY OF SUCH DAMAGE. */
 #include <math.h>
 #include <limits.h>
 #include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "poly.h"
 #include "active.h"
 #include "xrow.h"
 #include "wind.h"
 #include "convert.h"
 #include "heap.h"
+#include "sort.h"
 #include "moments.h"
+#include "query.h"
+#include "arena.h"
 
 #ifdef HAVE_MD5
 #include "MD5.h"
@@ -48,7 +53,10 @@ const char* gfxpoly_version()
     return PACKAGE_VERSION;
 }
 
-static gfxpoly_t*current_polygon = 0;
+/* the polygon currently being processed by this thread, for the debug dump in
+   gfxpoly_fail(). Thread-local, so that concurrent gfxpoly_process() calls
+   don't see each other's input. */
+static __thread gfxpoly_t*current_polygon = 0;
 void gfxpoly_fail(char*expr, char*file, int line, const char*function)
 {
     if (!current_polygon) {
@@ -117,12 +125,31 @@ type_t point_type = {
 };
 
 typedef struct _event {
-    eventtype_t type;
+    /* y and type, packed such that events are ordered by this key first
+       (see compare_events) */
+    uint64_t key;
     point_t p;
+    eventtype_t type;
     segment_t*s1;
     segment_t*s2;
 } event_t;
 
+#define EVENT_KEY(y,type) ((uint64_t)((uint32_t)(y)^0x80000000u)<<2|(type))
+
+#define CMP(a,b) ((a)<(b) ? -1 : ((a)>(b)))
+static inline int compare_segments(segment_t*s1, segment_t*s2)
+{
+    if (s1 == s2) return 0;
+    int d;
+    if ((d = CMP(s1->a.y, s2->a.y))) return d;
+    if ((d = CMP(s1->a.x, s2->a.x))) return d;
+    if ((d = CMP(s1->b.y, s2->b.y))) return d;
+    if ((d = CMP(s1->b.x, s2->b.x))) return d;
+    if ((d = CMP(s1->polygon_nr, s2->polygon_nr))) return d;
+    if ((d = CMP(s1->dir, s2->dir))) return d;
+    return CMP((uintptr_t)s1->fs, (uintptr_t)s2->fs);
+}
+
 /* compare_events_simple differs from compare_events in that it schedules
    events from left to right regardless of type. It's only used in horizontal
    processing, in order to get an x-wise sorting of the current scanline */
@@ -141,9 +168,10 @@ static inline int compare_events(const void*_a,const void*_b)
 {
     event_t* a = (event_t*)_a;
     event_t* b = (event_t*)_b;
-    int d = b->p.y - a->p.y;
-    if (d) return d;
-    /* we need to schedule end after intersect (so that a segment about
+    if (a->key != b->key)
+        return a->key < b->key ? 1 : -1;
+    /* ordered by y first, and by type second (that's what the key encodes):
+       we need to schedule end after intersect (so that a segment about
        to end has a chance to tear up a few other segs first) and start
        events after end (in order not to confuse the intersection check, which
        assumes there's an actual y overlap between active segments, and
@@ -153,19 +181,35 @@ static inline int compare_events(const void*_a,const void*_b)
        they have is to create snapping coordinates for the segments (still)
        existing in this scanline.
     */
-    d = b->type - a->type;
-    if (d) return d;
-    return 0;
 
-    /* I don't see any reason why we would need to order by x- at least as long
-       as we do horizontal lines in a seperate pass */
-    //d = b->p.x - a->p.x;
-    //return d;
+    /* The order of events within a scanline determines the order in which
+       segments lying on top of each other enter the active list, and hence
+       which of them draws the edge, and whether a pair of them with opposite
+       directions leaves a zero-width pair of edges. Break ties
+       deterministically, so that the result doesn't depend on the internals
+       of the queue (the parallel sweep relies on this). */
+    int d = compare_segments(b->s1, a->s1);
+    if (d || a->type != EVENT_CROSS) return d;
+    d = b->p.x - a->p.x;
+    if (d) return d;
+    return compare_segments(b->s2, a->s2);
 }
 
 #define COMPARE_EVENTS(x,y) (compare_events(x,y)>0)
 #define COMPARE_EVENTS_SIMPLE(x,y) (compare_events_simple(x,y)>0)
-HEAP_DEFINE(queue,event_t,COMPARE_EVENTS);
+HEAP_DEFINE_INLINE(queue,event_t,COMPARE_EVENTS);
+
+/* The first events of all the strokes are known before the sweep starts, so
+   instead of pushing them through the heap, they're sorted once and merged
+   with the heap while sweeping. */
+typedef struct _eventlist {
+    event_t*events;
+    event_t*tmp; // for sorting
+    int num;
+    int size;
+    int pos;
+    char sorted;
+} eventlist_t;
 HEAP_DEFINE(hqueue,event_t,COMPARE_EVENTS_SIMPLE);
 
 typedef struct _horizontal {
@@ -184,19 +228,84 @@ typedef struct _horizdata {
     int size;
 } horizdata_t;
 
+/* a segment crossing the boundary between two bands of the parallel sweep */
+typedef struct _seam {
+    /* identifies the input segment */
+    int polygon_nr;
+    gfxsegmentlist_t*stroke;
+    int stroke_pos;
+
+    /* the last point the segment received before this boundary, and the
+       band it received it in */
+    point_t pos;
+    struct _band*pos_band;
+
+    /* entry side (band after the boundary): output stroke starting with the
+       edge leading across the boundary, with its first point still unknown */
+    gfxsegmentlist_t*first;
+    segment_t*segment;
+
+    /* exit side (band before the boundary): entry seam of the same segment,
+       if it passed through the whole band without receiving a point */
+    struct _seam*from;
+} seam_t;
+
 typedef struct _status {
     int32_t y;
     double gridsize;
     actlist_t*actlist;
+    actlist_type_t actlist_type;
     queue_t queue;
+    eventlist_t starts;
     xrow_t*xrow;
     windrule_t*windrule;
     windcontext_t*context;
     segment_t*ending_segments;
+    int segment_count;
 
     horizdata_t horiz;
+    struct _hevent*hevents;
+    int hevents_size;
+    struct _horizontal**open;
+    int open_size;
+
+    /* segments and output strokes only live as long as this status, so
+       we bump-allocate them and release them in one go */
+    arena_t*arena;
+    slab_t segments;
 
     gfxsegmentlist_t*strokes;
+
+    /* if set, output edges go to this sink instead of into strokes */
+    gfxpoly_sink_t*sink;
+
+    /* measurement mode: don't build any output strokes, only add up their
+       length (if measure_perimeter is set) */
+    char measure_only;
+    char measure_perimeter;
+    double perimeter;
+
+    /* predicate mode (see gfxpoly_intersects etc.): stop the sweep as soon
+       as an area gets filled. With check_contact, also find out whether the
+       two polygons share a hot pixel. */
+    char stop_at_fill;
+    char filled;
+    char check_contact;
+    char contact;
+    struct _contactpoint*contacts;
+    int num_contacts;
+    int contacts_size;
+
+    /* Set if strokes were left out of the sweep (see filter_strokes). They
+       only leave out vertices above fix_windings_y (or below the area that
+       can get filled), but there, segments start or end without a partner
+       and the windings of the segments right of them go wrong. So on the
+       first scanline at or below fix_windings_y, we recalculate all of them. */
+    char fix_windings;
+    int32_t fix_windings_y;
+
+    /* if set, the sweep stores the active list of every slab in here */
+    gfxpoly_prepared_t*prepared;
 #ifdef CHECKS
     dict_t*seen_crossings; //list of crossing we saw so far
     dict_t*intersecting_segs; //list of segments intersecting in this scanline
@@ -335,22 +444,40 @@ void gfxpoly_dump(gfxpoly_t*poly)
     }
 }
 
+static void save_stroke(FILE*fi, segment_dir_t dir, point_t*points, int num_points)
+{
+    int s;
+    fprintf(fi, "%g setgray\n", dir==DIR_UP ? 0.7 : 0);
+    point_t p = points[0];
+    fprintf(fi, "%d %d moveto\n", p.x, p.y);
+    for(s=1;s<num_points;s++) {
+        p = points[s];
+        fprintf(fi, "%d %d lineto\n", p.x, p.y);
+    }
+    fprintf(fi, "stroke\n");
+}
+
 void gfxpoly_save(gfxpoly_t*poly, const char*filename)
 {
     FILE*fi = fopen(filename, "wb");
     fprintf(fi, "%% gridsize %f\n", poly->gridsize);
     fprintf(fi, "%% begin\n");
-    int s;
     gfxsegmentlist_t*stroke = poly->strokes;
     for(;stroke;stroke=stroke->next) {
-            fprintf(fi, "%g setgray\n", stroke->dir==DIR_UP ? 0.7 : 0);
-        point_t p = stroke->points[0];
-        fprintf(fi, "%d %d moveto\n", p.x, p.y);
-        for(s=1;s<stroke->num_points;s++) {
-            p = stroke->points[s];
-            fprintf(fi, "%d %d lineto\n", p.x, p.y);
-        }
-        fprintf(fi, "stroke\n");
+        save_stroke(fi, stroke->dir, stroke->points, stroke->num_points);
+    }
+    fprintf(fi, "showpage\n");
+    fclose(fi);
+}
+
+void gfxpoly_packed_save(gfxpoly_packed_t*poly, const char*filename)
+{
+    FILE*fi = fopen(filename, "wb");
+    fprintf(fi, "%% gridsize %f\n", poly->gridsize);
+    fprintf(fi, "%% begin\n");
+    int t;
+    for(t=0;t<poly->num_strokes;t++) {
+        save_stroke(fi, poly->dirs[t], &poly->points[poly->offsets[t]], poly->offsets[t+1] - poly->offsets[t]);
     }
     fprintf(fi, "showpage\n");
     fclose(fi);
@@ -436,14 +563,100 @@ void gfxpoly_save_as_pdf(gfxpoly_t*poly, const char*filename)
 }
 #endif
 
-inline static event_t* event_new()
+inline static void event_schedule(status_t*status, eventtype_t type, point_t p, segment_t*s1, segment_t*s2)
+{
+    event_t e;
+    e.key = EVENT_KEY(p.y, type);
+    e.p = p;
+    e.type = type;
+    e.s1 = s1;
+    e.s2 = s2;
+    queue_put(&status->queue, &e);
+}
+inline static void event_schedule_start(status_t*status, eventtype_t type, point_t p, segment_t*s1)
+{
+    eventlist_t*l = &status->starts;
+    if (l->num == l->size) {
+        l->size = l->size<64?64:l->size*2;
+        l->events = (event_t*)realloc(l->events, sizeof(event_t)*l->size);
+    }
+    event_t*e = &l->events[l->num++];
+    e->key = EVENT_KEY(p.y, type);
+    e->p = p;
+    e->type = type;
+    e->s1 = s1;
+    e->s2 = 0;
+}
+
+static int compare_events_ascending(const void*a, const void*b)
+{
+    return compare_events(b, a);
+}
+
+/* radix sort on the (y,type) key, then sort runs of equal keys by the
+   remaining criteria of compare_events() */
+static void events_sort(eventlist_t*l)
+{
+    event_t*events = l->events;
+    int num = l->num;
+    if (num < 64) {
+        qsort(events, num, sizeof(event_t), compare_events_ascending);
+        return;
+    }
+    l->tmp = (event_t*)realloc(l->tmp, sizeof(event_t)*l->size);
+    event_t*from = events, *to = l->tmp;
+    int shift, t;
+    for(shift=0;shift<36;shift+=12) {
+        int count[4097];
+        memset(count, 0, sizeof(count));
+        for(t=0;t<num;t++) {
+            count[((from[t].key>>shift)&4095)+1]++;
+        }
+        if (count[((from[0].key>>shift)&4095)+1] == num) {
+            /* all in one bucket */
+            continue;
+        }
+        for(t=0;t<4096;t++) {
+            count[t+1] += count[t];
+        }
+        for(t=0;t<num;t++) {
+            to[count[(from[t].key>>shift)&4095]++] = from[t];
+        }
+        event_t*swap = from; from = to; to = swap;
+    }
+    if (from != events) {
+        memcpy(events, from, sizeof(event_t)*num);
+    }
+
+    int start = 0;
+    for(t=1;t<=num;t++) {
+        if (t == num || events[t].key != events[start].key) {
+            if (t - start > 1)
+                qsort(&events[start], t - start, sizeof(event_t), compare_events_ascending);
+            start = t;
+        }
+    }
+}
+
+/* the next event of the sweep, either from the start events or the heap */
+inline static event_t* event_peek(status_t*status)
 {
-    event_t*e = calloc(1,sizeof(event_t));
+    eventlist_t*l = &status->starts;
+    event_t*e = queue_peek(&status->queue);
+    if (l->pos < l->num && (!e || COMPARE_EVENTS(&l->events[l->pos], e)))
+        return &l->events[l->pos];
     return e;
 }
-inline static void event_free(event_t*e)
+inline static void event_get(status_t*status, event_t*e)
 {
-    free(e);
+    eventlist_t*l = &status->starts;
+    event_t*next = event_peek(status);
+    if (next == &l->events[l->pos]) {
+        *e = *next;
+        l->pos++;
+    } else {
+        queue_get(&status->queue, e);
+    }
 }
 
 static void event_dump(status_t*status, event_t*e)
@@ -475,10 +688,9 @@ static void segment_dump(segment_t*s)
             (double)s->delta.x / s->delta.y, s->fs);
 }
 
-static void segment_init(segment_t*s, int32_t x1, int32_t y1, int32_t x2, int32_t y2, int polygon_nr, segment_dir_t dir)
+static void segment_init(segment_t*s, int32_t x1, int32_t y1, int32_t x2, int32_t y2, int polygon_nr, segment_dir_t dir, uintptr_t nr)
 {
-    static int segment_count=0;
-    s->nr = segment_count++;
+    s->nr = nr;
     s->dir = dir;
     if (y1!=y2) {
         assert(y1<y2);
@@ -496,7 +708,7 @@ static void segment_init(segment_t*s, int32_t x1, int32_t y1, int32_t x2, int32_
         }
 #ifdef DEBUG
         fprintf(stderr, "Scheduling horizontal segment [%d] (%.2f,%.2f) -> (%.2f,%.2f) %s\n",
-                segment_count,
+                (int)nr,
                 x1 * 0.05, y1 * 0.05, x2 * 0.05, y2 * 0.05, s->dir==DIR_UP?"up":"down");
 #endif
     }
@@ -542,10 +754,11 @@ static void segment_init(segment_t*s, int32_t x1, int32_t y1, int32_t x2, int32_
 #endif
 }
 
-static segment_t* segment_new(point_t a, point_t b, int polygon_nr, segment_dir_t dir)
+static segment_t* segment_new(status_t*status, point_t a, point_t b, int polygon_nr, segment_dir_t dir)
 {
-    segment_t*s = (segment_t*)calloc(1, sizeof(segment_t));
-    segment_init(s, a.x, a.y, b.x, b.y, polygon_nr, dir);
+    segment_t*s = (segment_t*)slab_alloc(&status->segments);
+    memset(s, 0, sizeof(segment_t));
+    segment_init(s, a.x, a.y, b.x, b.y, polygon_nr, dir, status->segment_count++);
     return s;
 }
 
@@ -555,13 +768,16 @@ static void segment_clear(segment_t*s)
     dict_clear(&s->scheduled_crossings);
 #endif
 }
-static void segment_destroy(segment_t*s)
+static void segment_destroy(status_t*status, segment_t*s)
 {
     segment_clear(s);
-    free(s);
+    slab_free(&status->segments, s);
 }
 
-static void advance_stroke(queue_t*queue, hqueue_t*hqueue, gfxsegmentlist_t*stroke, int polygon_nr, int pos, double gridsize)
+/* schedule the events for the next segments of a stroke. For the start of the
+   stroke, "initial" is set, and they go to the presorted list instead of the
+   heap. */
+static void advance_stroke(status_t*status, gfxsegmentlist_t*stroke, int polygon_nr, int pos, char initial)
 {
     if (!stroke)
         return;
@@ -570,7 +786,7 @@ static void advance_stroke(queue_t*queue, hqueue_t*hqueue, gfxsegmentlist_t*stro
        before horizontal events */
     while (pos < stroke->num_points-1) {
         assert(stroke->points[pos].y <= stroke->points[pos+1].y);
-        s = segment_new(stroke->points[pos], stroke->points[pos+1], polygon_nr, stroke->dir);
+        s = segment_new(status, stroke->points[pos], stroke->points[pos+1], polygon_nr, stroke->dir);
         s->fs = stroke->fs;
         pos++;
         s->stroke = 0;
@@ -579,20 +795,17 @@ static void advance_stroke(queue_t*queue, hqueue_t*hqueue, gfxsegmentlist_t*stro
         /*if (l->tmp)
             s->nr = l->tmp;*/
         fprintf(stderr, "[%d] (%.2f,%.2f) -> (%.2f,%.2f) %s (stroke %p, %d more to come)\n",
-                s->nr, s->a.x * gridsize, s->a.y * gridsize,
-                s->b.x * gridsize, s->b.y * gridsize,
+                s->nr, s->a.x * status->gridsize, s->a.y * status->gridsize,
+                s->b.x * status->gridsize, s->b.y * status->gridsize,
                 s->dir==DIR_UP?"up":"down", stroke, stroke->num_points - 1 - pos);
 #endif
-        event_t* e = event_new();
-        e->type = s->delta.y ? EVENT_START : EVENT_HORIZONTAL;
-        e->p = s->a;
-        e->s1 = s;
-        e->s2 = 0;
-
-        if (queue) queue_put(queue, e);
-        else hqueue_put(hqueue, e);
+        eventtype_t type = s->delta.y ? EVENT_START : EVENT_HORIZONTAL;
+        if (initial)
+            event_schedule_start(status, type, s->a, s);
+        else
+            event_schedule(status, type, s->a, s, 0);
 
-        if (e->type != EVENT_HORIZONTAL) {
+        if (s->delta.y) {
             break;
         }
     }
@@ -602,7 +815,7 @@ static void advance_stroke(queue_t*queue, hqueue_t*hqueue, gfxsegmentlist_t*stro
     }
 }
 
-static void gfxpoly_enqueue(gfxpoly_t*p, queue_t*queue, hqueue_t*hqueue, int polygon_nr)
+static void gfxpoly_enqueue(gfxpoly_t*p, status_t*status, int polygon_nr)
 {
     gfxsegmentlist_t*stroke = p->strokes;
     for(;stroke;stroke=stroke->next) {
@@ -614,7 +827,7 @@ static void gfxpoly_enqueue(gfxpoly_t*p, queue_t*queue, hqueue_t*hqueue, int pol
             assert(stroke->points[s].y <= stroke->points[s+1].y);
         }
 #endif
-        advance_stroke(queue, hqueue, stroke, polygon_nr, 0, p->gridsize);
+        advance_stroke(status, stroke, polygon_nr, 0, 1);
     }
 }
 
@@ -622,12 +835,7 @@ static void schedule_endpoint(status_t*status, segment_t*s)
 {
     // schedule end point of segment
     assert(s->b.y > status->y);
-    event_t*e = event_new();
-    e->type = EVENT_END;
-    e->p = s->b;
-    e->s1 = s;
-    e->s2 = 0;
-    queue_put(&status->queue, e);
+    event_schedule(status, EVENT_END, s->b, s, 0);
 }
 
 static void schedule_crossing(status_t*status, segment_t*s1, segment_t*s2)
@@ -808,12 +1016,7 @@ static void schedule_crossing(status_t*status, segment_t*s1, segment_t*s2)
     dict_put(&s2->scheduled_crossings, (void*)(uintptr_t)(s1->nr), 0);
 #endif
 
-    event_t* e = event_new();
-    e->type = EVENT_CROSS;
-    e->p = p;
-    e->s1 = s1;
-    e->s2 = s2;
-    queue_put(&status->queue, e);
+    event_schedule(status, EVENT_CROSS, p, s1, s2);
     return;
 }
 
@@ -856,8 +1059,67 @@ static inline box_t box_new(int32_t x, int32_t y)
 
 static void store_horizontal(status_t*status, point_t p1, point_t p2, edgestyle_t*fs, segment_dir_t dir, int polygon_nr);
 
-static void append_stroke(status_t*status, point_t a, point_t b, segment_dir_t dir, edgestyle_t*fs)
+/* hot pixels in the current scanline touched by the edges of a polygon */
+typedef struct _contactpoint {
+    int32_t x;
+    int polygon_nr;
+} contactpoint_t;
+
+#define CONTACTPOINT_KEY(c) ((c).x)
+SORT_DEFINE(contacts,contactpoint_t,CONTACTPOINT_KEY)
+
+static inline void contact_add(status_t*status, int32_t x, int polygon_nr)
+{
+    if (!status->check_contact || status->contact)
+        return;
+    /* twice the size, for sorting */
+    if (status->num_contacts*2+2 > status->contacts_size) {
+        status->contacts_size = status->contacts_size ? status->contacts_size*2 : 64;
+        status->contacts = realloc(status->contacts, sizeof(contactpoint_t)*status->contacts_size);
+    }
+    status->contacts[status->num_contacts].x = x;
+    status->contacts[status->num_contacts].polygon_nr = polygon_nr;
+    status->num_contacts++;
+}
+
+static void contact_check(status_t*status)
+{
+    int num = status->num_contacts;
+    contactpoint_t*c = status->contacts;
+    contacts_sort(c, num, c + num);
+    int t;
+    for(t=1;t<num;t++) {
+        if (c[t].x == c[t-1].x && c[t].polygon_nr != c[t-1].polygon_nr) {
+            status->contact = 1;
+            break;
+        }
+    }
+    status->num_contacts = 0;
+}
+
+/* adjacent segments only enclose an area if they're not collinear */
+static inline char span_has_area(segment_t*l, segment_t*r)
+{
+    return LINE_EQ(r->a, l) != 0 || LINE_EQ(r->b, l) != 0;
+}
+
+/* called for every segment whose windstate was recalculated. Any span
+   that became filled is next to one of these. */
+static inline void check_filled(status_t*status, segment_t*s)
+{
+    segment_t*left = s->left;
+    segment_t*right = s->right;
+    if ((left && left->wind.is_filled && span_has_area(left, s)) ||
+        (right && s->wind.is_filled && span_has_area(s, right)))
+        status->filled = 1;
+}
+
+static gfxsegmentlist_t* append_stroke(status_t*status, point_t a, point_t b, segment_dir_t dir, edgestyle_t*fs)
 {
+    if (status->sink) {
+        status->sink->edge(status->sink, a, b, dir, fs);
+        return 0;
+    }
     gfxsegmentlist_t*stroke = status->strokes;
     /* find a stoke to attach this segment to. It has to have an endpoint
        matching our start point, and a matching edgestyle */
@@ -868,26 +1130,31 @@ static void append_stroke(status_t*status, point_t a, point_t b, segment_dir_t d
         stroke = stroke->next;
     }
     if (!stroke) {
-        stroke = calloc(1,sizeof(gfxsegmentlist_t));
+        stroke = arena_calloc(status->arena, sizeof(gfxsegmentlist_t));
         stroke->dir = dir;
         stroke->fs = fs;
         stroke->next = status->strokes;
         status->strokes = stroke;
-        stroke->points_size = 2;
-        stroke->points = calloc(sizeof(point_t), stroke->points_size);
+        stroke->points_size = 4;
+        stroke->points = arena_alloc(status->arena, sizeof(point_t)*stroke->points_size);
         stroke->points[0] = a;
         stroke->num_points = 1;
     } else if (stroke->num_points == stroke->points_size) {
         assert(stroke->fs);
+        /* the old buffer stays in the arena until the end of this operation */
+        point_t*old = stroke->points;
         stroke->points_size *= 2;
-        stroke->points = realloc(stroke->points, sizeof(point_t)*stroke->points_size);
+        stroke->points = arena_alloc(status->arena, sizeof(point_t)*stroke->points_size);
+        memcpy(stroke->points, old, sizeof(point_t)*stroke->num_points);
     }
     stroke->points[stroke->num_points++] = b;
+    return stroke;
 }
 
 static void insert_point_into_segment(status_t*status, segment_t*s, point_t p)
 {
     assert(s->pos.x != p.x || s->pos.y != p.y);
+    contact_add(status, p.x, s->polygon_nr);
 
 #ifdef CHECKS
     if (!dict_contains(status->segs_with_point, s))
@@ -897,7 +1164,12 @@ static void insert_point_into_segment(status_t*status, segment_t*s, point_t p)
 
     if (s->pos.y != p.y) {
         /* non horizontal line- copy to output */
-        if (s->fs_out) {
+        if (s->fs_out && status->measure_only) {
+            if (status->measure_perimeter) {
+                double dx = p.x - s->pos.x, dy = p.y - s->pos.y;
+                status->perimeter += sqrt(dx*dx + dy*dy);
+            }
+        } else if (s->fs_out) {
             segment_dir_t dir = s->wind.is_filled?DIR_DOWN:DIR_UP;
 #ifdef DEBUG
             fprintf(stderr, "[%d] receives next point (%.2f,%.2f)->(%.2f,%.2f) (drawing (%s))\n", s->nr,
@@ -907,7 +1179,15 @@ static void insert_point_into_segment(status_t*status, segment_t*s, point_t p)
                     );
 #endif
             assert(s->pos.y != p.y);
-            append_stroke(status, s->pos, p, dir, s->fs_out);
+            if (s->seam) {
+                /* we don't know yet where this edge starts (that's determined
+                   by the previous band). It's filled in when the bands are
+                   stitched together. */
+                point_t unknown = {0, INT_MIN};
+                s->seam->first = append_stroke(status, unknown, p, dir, s->fs_out);
+            } else {
+                append_stroke(status, s->pos, p, dir, s->fs_out);
+            }
         } else {
 #ifdef DEBUG
             fprintf(stderr, "[%d] receives next point (%.2f,%.2f) (omitting)\n", s->nr,
@@ -915,6 +1195,7 @@ static void insert_point_into_segment(status_t*status, segment_t*s, point_t p)
                     p.y * status->gridsize);
 #endif
         }
+        s->seam = 0;
     } else {
         /* horizontal line. we need to look at this more closely at the end of this
            scanline */
@@ -972,6 +1253,38 @@ static void segrange_test_segment_max(segrange_t*range, segment_t*seg, int32_t y
     }
 }
 
+/* The active list is sorted by x at the bottom of the scanline, but a segment
+   may reach far to the left or right further up in the scanline, so we can't
+   simply stop adding points at the first segment to the right of (left of) a
+   hot pixel. Instead, store for every segment how far the positively sloped
+   segments to its right reach to the left at the top of the scanline, and
+   how far the negatively sloped segments to its left reach to the right. */
+static void compute_scanline_reach(status_t*status, int32_t y)
+{
+    int32_t ytop = y-1;
+    segment_t*s = actlist_leftmost(status->actlist);
+    segment_t*last = 0;
+    double reach = -HUGE_VAL;
+    for(;s;s=s->right) {
+        if (s->a.y != y && s->delta.x <= 0) {
+            double x = XPOS(s, ytop);
+            if (x > reach)
+                reach = x;
+        }
+        s->reach_right = reach;
+        last = s;
+    }
+    reach = HUGE_VAL;
+    for(s=last;s;s=s->left) {
+        if (s->a.y != y && s->delta.x > 0) {
+            double x = XPOS(s, ytop);
+            if (x < reach)
+                reach = x;
+        }
+        s->reach_left = reach;
+    }
+}
+
 /*
    SLOPE_POSITIVE:
       \+     \ +
@@ -983,14 +1296,22 @@ static void segrange_test_segment_max(segrange_t*range, segment_t*seg, int32_t y
 */
 static void add_points_to_positively_sloped_segments(status_t*status, int32_t y, segrange_t*range)
 {
-    segment_t*first=0, *last = 0;
+    segment_t*first=0, *last = 0, *finger = 0;
     int t;
     for(t=0;t<status->xrow->num;t++) {
         box_t box = box_new(status->xrow->x[t], y);
-        segment_t*seg = actlist_find(status->actlist, box.left2, box.left2);
+        /* the xrow is sorted, so continue where the previous search ended
+           (or at the start of the list) */
+        segment_t*seg = finger = actlist_find_from(status->actlist, finger, box.left2, box.left2);
 
         seg = actlist_right(status->actlist, seg);
         while (seg) {
+            if (LINE_EQ(box.right2, seg) < 0 && seg->reach_left > box.right1.x + 0.5) {
+                /* this segment, and all segments to the right of it, are to the right
+                   of the box at the bottom of the scanline, and none of them reaches
+                   back into it further up */
+                break;
+            }
             if (seg->a.y == y) {
                 // this segment started in this scanline, ignore it
                 seg->changed = 1;last = seg;if (!first) {first=seg;}
@@ -1004,10 +1325,9 @@ static void add_points_to_positively_sloped_segments(status_t*status, int32_t y,
                     seg->changed = 1;
                     insert_point_into_segment(status, seg, box.right2);
                 } else {
-                    /* we unfortunately can't break here- the active list is sorted according
-                       to the *bottom* of the scanline. hence pretty much everything that's still
-                       coming might reach into our box */
-                    //break;
+                    /* we can't break here- the active list is sorted according to the
+                       *bottom* of the scanline. hence pretty much everything that's still
+                       coming might reach into our box (see compute_scanline_reach) */
                 }
             }
             seg = seg->right;
@@ -1026,13 +1346,22 @@ static void add_points_to_positively_sloped_segments(status_t*status, int32_t y,
 */
 static void add_points_to_negatively_sloped_segments(status_t*status, int32_t y, segrange_t*range)
 {
-    segment_t*first=0, *last = 0;
+    segment_t*first=0, *last = 0, *finger = 0;
     int t;
     for(t=status->xrow->num-1;t>=0;t--) {
         box_t box = box_new(status->xrow->x[t], y);
-        segment_t*seg = actlist_find(status->actlist, box.right2, box.right2);
+        /* the xrow is sorted, so continue where the previous search ended */
+        segment_t*seg = finger = t<status->xrow->num-1 ?
+                        actlist_find_from(status->actlist, finger, box.right2, box.right2) :
+                        actlist_find(status->actlist, box.right2, box.right2);
 
         while (seg) {
+            if (LINE_EQ(box.left2, seg) >= 0 && seg->reach_right < box.left1.x - 0.5) {
+                /* this segment, and all segments to the left of it, are to the left of
+                   the box at the bottom of the scanline, and none of them reaches back
+                   into it further up */
+                break;
+            }
             if (seg->a.y == y) {
                 // this segment started in this scanline, ignore it
                 seg->changed = 1;last = seg;if (!first) {first=seg;}
@@ -1115,13 +1444,15 @@ static void add_points_to_ending_segments(status_t*status, int32_t y)
 #endif
         }
         // now that this is done, too, we can also finally free this segment
-        segment_destroy(seg);
+        segment_destroy(status, seg);
         seg = next;
     }
     status->ending_segments = 0;
 }
 
-static void recalculate_windings(status_t*status, segrange_t*range)
+/* If all is set, the windings of all the segments are recalculated, not only
+   the ones of the changed segments in range. */
+static void recalculate_windings(status_t*status, segrange_t*range, char all)
 {
 #ifdef DEBUG
     fprintf(stderr, "range: [%d]..[%d]\n", SEGNR(range->segmin), SEGNR(range->segmax));
@@ -1160,12 +1491,16 @@ static void recalculate_windings(status_t*status, segrange_t*range)
     s = actlist_leftmost(status->actlist);
     end = 0;
 #endif
+    if (all) {
+        s = actlist_leftmost(status->actlist);
+        end = 0;
+    }
 
     if (end)
         end = end->right;
     while (s!=end) {
 #ifndef CHECKS
-        if (s->changed)
+        if (s->changed || all)
 #endif
         {
             segment_t* left = actlist_left(status->actlist, s);
@@ -1181,6 +1516,8 @@ static void recalculate_windings(status_t*status, segrange_t*range)
 #endif
             assert(!(!s->changed && fs_old!=s->fs_out));
             s->changed = 0;
+            if (status->stop_at_fill)
+                check_filled(status, s);
 
 #ifdef CHECKS
             s->fs_out_ok = 1;
@@ -1310,7 +1647,9 @@ static windstate_t process_horizontal_fragment(status_t*status, horizontal_t*h,
     point_t p1 = {x1,h->y};
     point_t p2 = {x2,h->y};
 
-    if (fs) {
+    if (fs && status->measure_only) {
+        status->perimeter += x2 - x1;
+    } else if (fs) {
         //append_stroke(status, p1, p2, DIR_INVERT(h->dir), fs);
         append_stroke(status, p1, p2, dir, fs);
     }
@@ -1336,45 +1675,45 @@ typedef struct _hevents {
     int num;
 } hevents_t;
 
-static int compare_hevents(const void *_e1, const void *_e2)
-{
-    hevent_t*e1 = (hevent_t*)_e1;
-    hevent_t*e2 = (hevent_t*)_e2;
-    int diff = e1->x - e2->x;
-    if (diff) return diff;
-    return e1->type - e2->type; //schedule hotpixel before hend
-}
+/* make sure a buffer has room for num elements, keeping it for the next scanline */
+#define BUFFER_RESERVE(buf,size,num) \
+    if ((size) < (num)) { \
+        (size) = (num) < 16 ? 16 : (num)*2; \
+        (buf) = realloc((buf), sizeof((buf)[0])*(size)); \
+    }
+
+#define HEVENT_KEY(e) ((e).x)
+SORT_DEFINE(hevents,hevent_t,HEVENT_KEY)
 
+/* returns the starts and ends of all horizontals, sorted by x. At the same x,
+   ends come before starts, and both are in the order in which the horizontals
+   were stored. (The hot pixels, which go before both, come from the xrow) */
 static hevents_t hevents_fill(status_t*status)
 {
     horizdata_t*horiz = &status->horiz;
-    xrow_t*xrow = status->xrow;
 
+    /* the second half is scratch space for sorting */
+    BUFFER_RESERVE(status->hevents, status->hevents_size, horiz->num*4);
     hevents_t e;
-    e.events = malloc(sizeof(hevent_t)*(horiz->num*2 + xrow->num));
-    e.num = 0;
+    e.events = status->hevents;
+    e.num = horiz->num*2;
 
     int t;
     for(t=0;t<horiz->num;t++) {
         assert(horiz->data[t].x1 != horiz->data[t].x2);
-        e.events[e.num].x = horiz->data[t].x1;
-        e.events[e.num].h = &horiz->data[t];
-        e.events[e.num].type = hevent_start;
-        e.num++;
-        e.events[e.num].x = horiz->data[t].x2;
-        e.events[e.num].h = &horiz->data[t];
-        e.events[e.num].type = hevent_end;
-        e.num++;
-    }
-    for(t=0;t<xrow->num;t++) {
-        e.events[e.num].x = status->xrow->x[t];
-        e.events[e.num].h = 0;
-        e.events[e.num].type = hevent_hotpixel;
-        e.num++;
-    }
-    qsort(e.events, e.num, sizeof(hevent_t), compare_hevents);
+        hevent_t*end = &e.events[t];
+        end->x = horiz->data[t].x2;
+        end->h = &horiz->data[t];
+        end->type = hevent_end;
+        hevent_t*start = &e.events[horiz->num+t];
+        start->x = horiz->data[t].x1;
+        start->h = &horiz->data[t];
+        start->type = hevent_start;
+    }
+    /* the sort is stable, which keeps the order we just established for
+       events at the same x */
+    hevents_sort(e.events, e.num, e.events + e.num);
     return e;
-
 }
 
 static void process_horizontals(status_t*status)
@@ -1386,11 +1725,25 @@ static void process_horizontals(status_t*status)
 
     hevents_t events = hevents_fill(status);
     int num_open = 0;
-    horizontal_t**open = malloc(sizeof(horizontal_t*)*horiz->num);
+    BUFFER_RESERVE(status->open, status->open_size, horiz->num);
+    horizontal_t**open = status->open;
 
-    int s,t;
-    for(t=0;t<events.num;t++) {
-        hevent_t*e = &events.events[t];
+    /* merge the horizontal events with the (sorted) hot pixels */
+    xrow_t*xrow = status->xrow;
+    int x = 0;
+    hevent_t hotpixel;
+    hotpixel.h = 0;
+    hotpixel.type = hevent_hotpixel;
+
+    int s,t = 0;
+    while (t < events.num || x < xrow->num) {
+        hevent_t*e;
+        if (x < xrow->num && (t == events.num || xrow->x[x] <= events.events[t].x)) {
+            hotpixel.x = xrow->x[x++];
+            e = &hotpixel;
+        } else {
+            e = &events.events[t++];
+        }
         switch(e->type) {
             case hevent_start:
                 e->h->pos = num_open;
@@ -1419,6 +1772,7 @@ static void process_horizontals(status_t*status)
                     for(s=0;s<num_open;s++) {
                         int x1 = open[s]->xpos;
                         int x2 = e->x;
+                        contact_add(status, x2, open[s]->polygon_nr);
                         assert(status->y == open[s]->y);
                         if (!s)
                             below = get_horizontal_first_windstate(status, x1, x2);
@@ -1430,8 +1784,6 @@ static void process_horizontals(status_t*status)
             break;
         }
     }
-    free(open);
-    free(events.events);
 }
 
 static void store_horizontal(status_t*status, point_t p1, point_t p2, edgestyle_t*fs, segment_dir_t dir, int polygon_nr)
@@ -1439,6 +1791,13 @@ static void store_horizontal(status_t*status, point_t p1, point_t p2, edgestyle_
     assert(p1.y == p2.y);
     assert(p1.x != p2.x); // TODO: can this happen?
 
+    contact_add(status, p1.x, polygon_nr);
+    contact_add(status, p2.x, polygon_nr);
+
+    /* horizontal lines don't contribute to the area */
+    if (status->measure_only && !status->measure_perimeter && !status->check_contact)
+        return;
+
     if (p1.x > p2.x) {
         dir = DIR_INVERT(dir);
         point_t p_1 = p1;
@@ -1476,8 +1835,8 @@ static void event_apply(status_t*status, event_t*e)
             segment_t*s = e->s1;
             intersect_with_horizontal(status, s);
             store_horizontal(status, s->a, s->b, s->fs, s->dir, s->polygon_nr);
-            advance_stroke(&status->queue, 0, s->stroke, s->polygon_nr, s->stroke_pos, status->gridsize);
-            segment_destroy(s);e->s1=0;
+            advance_stroke(status, s->stroke, s->polygon_nr, s->stroke_pos, 0);
+            segment_destroy(status, s);e->s1=0;
             break;
         }
         case EVENT_END: {
@@ -1498,7 +1857,7 @@ static void event_apply(status_t*status, event_t*e)
             /* schedule segment for xrow handling */
             s->left = 0; s->right = status->ending_segments;
             status->ending_segments = s;
-            advance_stroke(&status->queue, 0, s->stroke, s->polygon_nr, s->stroke_pos, status->gridsize);
+            advance_stroke(status, s->stroke, s->polygon_nr, s->stroke_pos, 0);
             break;
         }
         case EVENT_START: {
@@ -1563,98 +1922,306 @@ static void check_status(status_t*status)
 }
 #endif
 
-gfxpoly_t* gfxpoly_process(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments)
+/* copy the strokes we collected in the arena into individually allocated
+   memory (as expected by gfxpoly_destroy), trimming the point arrays to size */
+static gfxsegmentlist_t* strokes_from_arena(gfxsegmentlist_t*stroke)
 {
-    current_polygon = poly1;
+    gfxsegmentlist_t*first = 0;
+    gfxsegmentlist_t**last = &first;
+    for(;stroke;stroke=stroke->next) {
+        if (!stroke->num_points) {
+            /* merged into another stroke */
+            continue;
+        }
+        gfxsegmentlist_t*s = (gfxsegmentlist_t*)malloc(sizeof(gfxsegmentlist_t));
+        *s = *stroke;
+        s->points_size = s->num_points;
+        s->points = (point_t*)malloc(sizeof(point_t)*s->num_points);
+        memcpy(s->points, stroke->points, sizeof(point_t)*s->num_points);
+        s->next = 0;
+        *last = s;
+        last = &s->next;
+    }
+    return first;
+}
 
-    status_t status;
-    memset(&status, 0, sizeof(status_t));
-    status.gridsize = poly1->gridsize;
-    status.windrule = windrule;
-    status.context = context;
-    status.actlist = actlist_new();
-
-    queue_init(&status.queue);
-    gfxpoly_enqueue(poly1, &status.queue, 0, /*polygon nr*/0);
-    if (poly2) {
-        assert(poly1->gridsize == poly2->gridsize);
-        gfxpoly_enqueue(poly2, &status.queue, 0, /*polygon nr*/1);
+/* like strokes_from_arena, but into a packed polygon */
+static gfxpoly_packed_t* strokes_to_packed(gfxsegmentlist_t*strokes, double gridsize)
+{
+    int num_strokes = 0, num_points = 0;
+    gfxsegmentlist_t*stroke;
+    for(stroke=strokes;stroke;stroke=stroke->next) {
+        if (stroke->num_points) {
+            num_strokes++;
+            num_points += stroke->num_points;
+        }
+    }
+    gfxpoly_packed_t*p = gfxpoly_packed_new(gridsize, num_strokes, num_points);
+    int n = 0, pos = 0;
+    for(stroke=strokes;stroke;stroke=stroke->next) {
+        if (!stroke->num_points) {
+            /* merged into another stroke */
+            continue;
+        }
+        p->offsets[n] = pos;
+        p->dirs[n] = stroke->dir;
+        p->fs[n] = stroke->fs;
+        memcpy(&p->points[pos], stroke->points, sizeof(point_t)*stroke->num_points);
+        pos += stroke->num_points;
+        n++;
+    }
+    return p;
+}
+
+/* fill in a gfxpoly_t whose strokes point into the packed polygon's point
+   array, so that the sweep can read the packed polygon as it is. The
+   stroke headers live in the arena, i.e., until engine_recycle. */
+static void packed_view(status_t*status, gfxpoly_packed_t*packed, gfxpoly_t*view)
+{
+    view->gridsize = packed->gridsize;
+    gfxsegmentlist_t**last = &view->strokes;
+    int t;
+    for(t=0;t<packed->num_strokes;t++) {
+        gfxsegmentlist_t*s = (gfxsegmentlist_t*)arena_alloc(status->arena, sizeof(gfxsegmentlist_t));
+        s->dir = packed->dirs[t];
+        s->fs = packed->fs[t];
+        s->points = &packed->points[packed->offsets[t]];
+        s->num_points = s->points_size = packed->offsets[t+1] - packed->offsets[t];
+        *last = s;
+        last = &s->next;
+    }
+    *last = 0;
+}
+
+static void status_init(status_t*status)
+{
+    memset(status, 0, sizeof(status_t));
+    status->actlist_type = ACTLIST_DEFAULT;
+    status->actlist = actlist_new_type(status->actlist_type);
+    status->arena = arena_new(0);
+    slab_init(&status->segments, status->arena, sizeof(segment_t));
+    queue_init(&status->queue);
+    status->xrow = xrow_new();
+}
+
+/* prepare for a new operation. All the buffers from the previous one are
+   kept, only their contents are reset. */
+static void status_start(status_t*status, gfxpoly_t*poly1, windrule_t*windrule, windcontext_t*context)
+{
+    status->gridsize = poly1->gridsize;
+    status->windrule = windrule;
+    status->context = context;
+    status->y = 0;
+    status->ending_segments = 0;
+    status->segment_count = 0;
+    status->strokes = 0;
+    status->starts.num = status->starts.pos = 0;
+    status->starts.sorted = 0;
+    status->filled = status->contact = 0;
+    status->num_contacts = 0;
+    if (actlist_size(status->actlist) || status->actlist->type != status->actlist_type) {
+        /* the previous sweep was stopped early, or the index type changed */
+        actlist_destroy(status->actlist);
+        status->actlist = actlist_new_type(status->actlist_type);
     }
+    queue_clear(&status->queue);
+    xrow_reset(status->xrow);
+    horiz_reset(&status->horiz);
+#ifdef CHECKS
+    status->seen_crossings = dict_new(&point_type);
+#endif
+}
 
+static void status_finish(status_t*status)
+{
+    status->fix_windings = 0;
 #ifdef CHECKS
-    status.seen_crossings = dict_new(&point_type);
+    dict_destroy(status->seen_crossings);
 #endif
+}
+
+/* frees everything except the arena, which still holds the output strokes */
+static void status_destroy(status_t*status)
+{
+    actlist_destroy(status->actlist);
+    queue_destroy(&status->queue);
+    free(status->starts.events);
+    free(status->starts.tmp);
+    horiz_destroy(&status->horiz);
+    free(status->hevents);
+    free(status->open);
+    free(status->contacts);
+    xrow_destroy(status->xrow);
+}
+
+/* process all scanlines with ymin <= y < ymax. Moments are integrated over
+   the same y range. */
+static void sweep(status_t*status, moments_t*moments, int32_t ymin, int32_t ymax)
+{
     int32_t lasty = INT_MIN;
     if (moments) {
         memset(moments, 0, sizeof(moments_t));
     }
 
-    status.xrow = xrow_new();
+    if (!status->starts.sorted)
+        events_sort(&status->starts);
+
+    event_t*e = event_peek(status);
+    if (e && e->p.y >= ymax)
+        e = 0;
+
+    if (moments && status->actlist->list) {
+        /* segments reaching into this range from above */
+        moments_update(moments, status->actlist, ymin, e ? e->p.y : ymax);
+    }
 
-    event_t*e = queue_get(&status.queue);
     while (e) {
         assert(e->s1->fs);
-        status.y = e->p.y;
+        status->y = e->p.y;
 #ifdef CHECKS
-        assert(status.y > lasty);
-        status.intersecting_segs = dict_new(&ptr_type);
-        status.segs_with_point = dict_new(&ptr_type);
+        assert(status->y > lasty);
+        status->intersecting_segs = dict_new(&ptr_type);
+        status->segs_with_point = dict_new(&ptr_type);
 #endif
 
 #ifdef DEBUG
-        fprintf(stderr, "----------------------------------- %.2f\n", status.y * status.gridsize);
-        actlist_dump(status.actlist, status.y-1, status.gridsize);
+        fprintf(stderr, "----------------------------------- %.2f\n", status->y * status->gridsize);
+        actlist_dump(status->actlist, status->y-1, status->gridsize);
 #endif
 #ifdef CHECKS
-        actlist_verify(status.actlist, status.y-1);
+        actlist_verify(status->actlist, status->y-1);
 #endif
         if (moments && lasty > INT_MIN) {
-            moments_update(moments, status.actlist, lasty, status.y);
+            moments_update(moments, status->actlist, lasty, status->y);
+        }
+        if (status->prepared && lasty > INT_MIN) {
+            prepared_add_slab(status->prepared, status->actlist, lasty, status->y);
         }
 
-        xrow_reset(status.xrow);
-        horiz_reset(&status.horiz);
+        xrow_reset(status->xrow);
+        horiz_reset(&status->horiz);
 
         do {
-            xrow_add(status.xrow, e->p.x);
-            event_apply(&status, e);
-            event_free(e);
-            e = queue_get(&status.queue);
-        } while (e && status.y == e->p.y);
-
-        xrow_sort(status.xrow);
+            event_t event;
+            event_get(status, &event);
+            xrow_add(status->xrow, event.p.x);
+            contact_add(status, event.p.x, event.s1->polygon_nr);
+            if (event.s2)
+                contact_add(status, event.p.x, event.s2->polygon_nr);
+            event_apply(status, &event);
+            e = event_peek(status);
+        } while (e && status->y == e->p.y);
+
+        xrow_sort(status->xrow);
         segrange_t range;
         memset(&range, 0, sizeof(range));
 #ifdef DEBUG
-        actlist_dump(status.actlist, status.y, status.gridsize);
-        xrow_dump(status.xrow, status.gridsize);
+        actlist_dump(status->actlist, status->y, status->gridsize);
+        xrow_dump(status->xrow, status->gridsize);
 #endif
-        add_points_to_positively_sloped_segments(&status, status.y, &range);
-        add_points_to_negatively_sloped_segments(&status, status.y, &range);
-        add_points_to_ending_segments(&status, status.y);
-
-        recalculate_windings(&status, &range);
-
-        actlist_verify(status.actlist, status.y);
-        process_horizontals(&status);
+        compute_scanline_reach(status, status->y);
+        add_points_to_positively_sloped_segments(status, status->y, &range);
+        add_points_to_negatively_sloped_segments(status, status->y, &range);
+        add_points_to_ending_segments(status, status->y);
+
+        char all = status->fix_windings && status->y >= status->fix_windings_y;
+        if (all)
+            status->fix_windings = 0;
+        recalculate_windings(status, &range, all);
+
+        actlist_verify(status->actlist, status->y);
+        process_horizontals(status);
+        if (status->sink && status->sink->scanline)
+            status->sink->scanline(status->sink, status->y);
+        if (status->check_contact)
+            contact_check(status);
 #ifdef CHECKS
-        check_status(&status);
-        dict_destroy(status.intersecting_segs);
-        dict_destroy(status.segs_with_point);
+        check_status(status);
+        dict_destroy(status->intersecting_segs);
+        dict_destroy(status->segs_with_point);
 #endif
-        lasty = status.y;
+        if (status->filled && status->stop_at_fill)
+            break;
+        lasty = status->y;
+        if (e && e->p.y >= ymax)
+            e = 0;
     }
-#ifdef CHECKS
-    dict_destroy(status.seen_crossings);
-#endif
-    actlist_destroy(status.actlist);
-    queue_destroy(&status.queue);
-    horiz_destroy(&status.horiz);
-    xrow_destroy(status.xrow);
+
+    if (moments && lasty > INT_MIN && ymax < INT_MAX) {
+        /* segments reaching into the next range */
+        moments_update(moments, status->actlist, lasty, ymax);
+    }
+}
+
+struct _gfxpoly_engine {
+    status_t status;
+};
+
+gfxpoly_engine_t* gfxpoly_engine_new()
+{
+    gfxpoly_engine_t*engine = (gfxpoly_engine_t*)malloc(sizeof(gfxpoly_engine_t));
+    status_init(&engine->status);
+    return engine;
+}
+
+void gfxpoly_engine_set_actlist(gfxpoly_engine_t*engine, actlist_type_t type)
+{
+    engine->status.actlist_type = type;
+}
+
+void gfxpoly_engine_destroy(gfxpoly_engine_t*engine)
+{
+    status_destroy(&engine->status);
+    arena_destroy(engine->status.arena);
+    free(engine);
+}
+
+/* sweeps num polygons at once, with polygon numbers 0...num-1 */
+static void engine_sweep_many(gfxpoly_engine_t*engine, gfxpoly_t**polys, int num, windrule_t*windrule, windcontext_t*context, moments_t*moments)
+{
+    status_t*status = &engine->status;
+    status_start(status, polys[0], windrule, context);
+
+    int t;
+    for(t=0;t<num;t++) {
+        assert(polys[t]->gridsize == polys[0]->gridsize);
+        gfxpoly_enqueue(polys[t], status, /*polygon nr*/t);
+    }
+
+    sweep(status, moments, INT_MIN, INT_MAX);
+    status_finish(status);
+}
+
+static void engine_sweep(gfxpoly_engine_t*engine, gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments)
+{
+    gfxpoly_t*polys[2] = {poly1, poly2};
+    engine_sweep_many(engine, polys, poly2 ? 2 : 1, windrule, context, moments);
+}
+
+static void engine_recycle(gfxpoly_engine_t*engine)
+{
+    status_t*status = &engine->status;
+    status->strokes = 0;
+    /* all segments have ended (or, if the sweep was stopped early, are only
+       referenced by an active list status_start throws away), so we can
+       recycle the arena */
+    arena_reset(status->arena);
+    slab_init(&status->segments, status->arena, sizeof(segment_t));
+}
+
+static gfxpoly_t* engine_process_many(gfxpoly_engine_t*engine, gfxpoly_t**polys, int num, windrule_t*windrule, windcontext_t*context, moments_t*moments)
+{
+    current_polygon = polys[0];
+
+    status_t*status = &engine->status;
+    status->measure_only = 0;
+    status->stop_at_fill = status->check_contact = 0;
+    engine_sweep_many(engine, polys, num, windrule, context, moments);
 
     gfxpoly_t*p = (gfxpoly_t*)malloc(sizeof(gfxpoly_t));
-    p->gridsize = poly1->gridsize;
-    p->strokes = status.strokes;
+    p->gridsize = polys[0]->gridsize;
+    p->strokes = strokes_from_arena(status->strokes);
+    engine_recycle(engine);
 
 #ifdef CHECKS
     /* we only add segments with non-empty edgestyles to strokes in
@@ -1665,30 +2232,1332 @@ gfxpoly_t* gfxpoly_process(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule
         stroke = stroke->next;
     }
 #endif
+    current_polygon = 0;
     return p;
 }
 
-gfxpoly_t* gfxpoly_intersect(gfxpoly_t*p1, gfxpoly_t*p2)
+gfxpoly_t* gfxpoly_engine_process(gfxpoly_engine_t*engine, gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments)
 {
-    return gfxpoly_process(p1, p2, &windrule_intersect, &twopolygons, NULL);
+    gfxpoly_t*polys[2] = {poly1, poly2};
+    return engine_process_many(engine, polys, poly2 ? 2 : 1, windrule, context, moments);
 }
-gfxpoly_t* gfxpoly_union(gfxpoly_t*p1, gfxpoly_t*p2)
+
+gfxpoly_t* gfxpoly_process(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments)
 {
-    return gfxpoly_process(p1, p2, &windrule_union, &twopolygons, NULL);
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    gfxpoly_t*p = gfxpoly_engine_process(engine, poly1, poly2, windrule, context, moments);
+    gfxpoly_engine_destroy(engine);
+    return p;
 }
-gfxpoly_t* gfxpoly_subtract(gfxpoly_t*p1, gfxpoly_t*p2)
+
+gfxpoly_t* gfxpoly_process_many(gfxpoly_t**polys, int num, windrule_t*windrule, windcontext_t*context, moments_t*moments)
 {
-    return gfxpoly_process(p1, p2, &windrule_subtract, &twopolygons, NULL);
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    gfxpoly_t*p = engine_process_many(engine, polys, num, windrule, context, moments);
+    gfxpoly_engine_destroy(engine);
+    return p;
 }
-gfxpoly_t* gfxpoly_selfintersect_evenodd(gfxpoly_t*p)
+
+gfxpoly_packed_t* gfxpoly_engine_process_packed(gfxpoly_engine_t*engine, gfxpoly_packed_t*poly1, gfxpoly_packed_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments)
 {
-    return gfxpoly_process(p, NULL, &windrule_evenodd, &onepolygon, NULL);
+    status_t*status = &engine->status;
+    gfxpoly_t views[2];
+    gfxpoly_t*polys[2] = {&views[0], &views[1]};
+    packed_view(status, poly1, &views[0]);
+    if (poly2)
+        packed_view(status, poly2, &views[1]);
+    current_polygon = polys[0];
+
+    status->measure_only = 0;
+    status->stop_at_fill = status->check_contact = 0;
+    engine_sweep_many(engine, polys, poly2 ? 2 : 1, windrule, context, moments);
+
+    gfxpoly_packed_t*p = strokes_to_packed(status->strokes, poly1->gridsize);
+    engine_recycle(engine);
+    current_polygon = 0;
+    return p;
 }
-gfxpoly_t* gfxpoly_selfintersect_circular(gfxpoly_t*p)
+
+gfxpoly_packed_t* gfxpoly_process_packed(gfxpoly_packed_t*poly1, gfxpoly_packed_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments)
 {
-    return gfxpoly_process(p, NULL, &windrule_circular, &onepolygon, NULL);
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    gfxpoly_packed_t*p = gfxpoly_engine_process_packed(engine, poly1, poly2, windrule, context, moments);
+    gfxpoly_engine_destroy(engine);
+    return p;
 }
 
+void* gfxpoly_engine_process_to_sink(gfxpoly_engine_t*engine, gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, gfxpoly_sink_t*sink)
+{
+    current_polygon = poly1;
+
+    status_t*status = &engine->status;
+    status->measure_only = 0;
+    status->stop_at_fill = status->check_contact = 0;
+    status->sink = sink;
+    if (sink->setgridsize)
+        sink->setgridsize(sink, poly1->gridsize);
+    engine_sweep(engine, poly1, poly2, windrule, context, 0);
+    assert(!status->strokes);
+    status->sink = 0;
+    engine_recycle(engine);
+
+    current_polygon = 0;
+    return sink->finish ? sink->finish(sink) : 0;
+}
+
+void* gfxpoly_process_to_sink(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, gfxpoly_sink_t*sink)
+{
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    void*result = gfxpoly_engine_process_to_sink(engine, poly1, poly2, windrule, context, sink);
+    gfxpoly_engine_destroy(engine);
+    return result;
+}
+
+void gfxpoly_engine_measure(gfxpoly_engine_t*engine, gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments, double*perimeter)
+{
+    current_polygon = poly1;
+
+    status_t*status = &engine->status;
+    status->measure_only = 1;
+    status->measure_perimeter = perimeter != 0;
+    status->perimeter = 0;
+    status->stop_at_fill = status->check_contact = 0;
+    engine_sweep(engine, poly1, poly2, windrule, context, moments);
+    assert(!status->strokes);
+    engine_recycle(engine);
+
+    if (moments)
+        moments_normalize(moments, poly1->gridsize);
+    if (perimeter)
+        *perimeter = status->perimeter * poly1->gridsize;
+    current_polygon = 0;
+}
+
+gfxpoly_prepared_t* gfxpoly_prepare(gfxpoly_t*poly, windrule_t*windrule, windcontext_t*context)
+{
+    current_polygon = poly;
+
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    status_t*status = &engine->status;
+    status->measure_only = 1;
+    status->measure_perimeter = 0;
+    status->prepared = prepared_new(poly->gridsize, windrule, context);
+    engine_sweep(engine, poly, 0, windrule, context, 0);
+    gfxpoly_prepared_t*prepared = status->prepared;
+    gfxpoly_engine_destroy(engine);
+
+    current_polygon = 0;
+    return prepared;
+}
+
+void gfxpoly_measure(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments, double*perimeter)
+{
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    gfxpoly_engine_measure(engine, poly1, poly2, windrule, context, moments, perimeter);
+    gfxpoly_engine_destroy(engine);
+}
+
+/* ------------------------------ parallel sweep ------------------------------
+
+   The y range is cut into bands, which are swept independently. A band starts
+   out with all the segments crossing its upper boundary already in the active
+   list, in the order the serial sweep would have them in at that point. Hence,
+   with the crossings and windings derived from that order, it creates the
+   same hotpixels and output edges as the serial sweep. The only thing a band
+   can't know is where the segments coming in from above received their last
+   point, so the edges leading across the boundary get their start point filled
+   in afterwards, by walking the boundaries from top to bottom.
+*/
+
+typedef struct _strokeend {
+    point_t p;
+    gfxsegmentlist_t*stroke;
+} strokeend_t;
+
+typedef struct _band {
+    status_t status;
+    gfxpoly_t*poly1;
+    gfxpoly_t*poly2;
+    windrule_t*windrule;
+    windcontext_t*context;
+    moments_t*moments;
+    int32_t ymin, ymax;
+
+    seam_t*entries;
+    int num_entries;
+    seam_t*exits;
+    int num_exits;
+
+    /* output strokes, sorted by their end point */
+    strokeend_t*ends;
+    int num_ends;
+} band_t;
+
+static int compare_seams(const void*_s1, const void*_s2)
+{
+    const seam_t*s1 = (const seam_t*)_s1;
+    const seam_t*s2 = (const seam_t*)_s2;
+    if (s1->polygon_nr != s2->polygon_nr)
+        return s1->polygon_nr < s2->polygon_nr ? -1 : 1;
+    if (s1->stroke != s2->stroke)
+        return (uintptr_t)s1->stroke < (uintptr_t)s2->stroke ? -1 : 1;
+    if (s1->stroke_pos != s2->stroke_pos)
+        return s1->stroke_pos < s2->stroke_pos ? -1 : 1;
+    return 0;
+}
+
+static int sign128(__int128 v)
+{
+    return v<0 ? -1 : (v>0 ? 1 : 0);
+}
+
+/* the order of the active list at the start of scanline y is the x order at the
+   end of scanline y-1, or rather, an infinitesimal amount below it, since
+   crossings on y-1 have already been processed. */
+typedef struct _seamorder {
+    segment_t*s;
+    int32_t y;
+} seamorder_t;
+
+static int compare_seamorder(const void*_o1, const void*_o2)
+{
+    const seamorder_t*o1 = (const seamorder_t*)_o1;
+    const seamorder_t*o2 = (const seamorder_t*)_o2;
+    segment_t*s1 = o1->s;
+    segment_t*s2 = o2->s;
+    int64_t y = o1->y;
+
+    /* x(y) = (k + dx*y) / dy, compared without rounding */
+    __int128 x1 = (__int128)((int64_t)s1->k + (int64_t)s1->delta.x*y);
+    __int128 x2 = (__int128)((int64_t)s2->k + (int64_t)s2->delta.x*y);
+    int d = sign128(x1*s2->delta.y - x2*s1->delta.y);
+    if (d) return d;
+
+    d = sign128((__int128)s1->delta.x*s2->delta.y - (__int128)s2->delta.x*s1->delta.y);
+    if (d) return d;
+
+    /* on top of each other: segments inserted later go to the right.
+       (compare_segments() is also how start events are ordered) */
+    return compare_segments(s1, s2);
+}
+
+static void band_enqueue(band_t*band, gfxpoly_t*p, int polygon_nr, int*size)
+{
+    status_t*status = &band->status;
+    gfxsegmentlist_t*stroke = p->strokes;
+    for(;stroke;stroke=stroke->next) {
+        assert(stroke->num_points > 1);
+        int32_t y1 = stroke->points[0].y;
+        int32_t y2 = stroke->points[stroke->num_points-1].y;
+        if (y1 >= band->ymin) {
+            if (y1 < band->ymax)
+                advance_stroke(status, stroke, polygon_nr, 0, 1);
+            continue;
+        }
+        if (y2 < band->ymin)
+            continue;
+
+        /* find the segment crossing the start of this band */
+        int l = 0, r = stroke->num_points-1;
+        while (r-l > 1) {
+            int m = (l+r)/2;
+            if (stroke->points[m].y < band->ymin)
+                l = m;
+            else
+                r = m;
+        }
+        segment_t*s = segment_new(status, stroke->points[l], stroke->points[l+1], polygon_nr, stroke->dir);
+        s->fs = stroke->fs;
+        s->stroke = stroke;
+        s->stroke_pos = l+1;
+
+        if (band->num_entries == *size) {
+            *size = *size ? *size*2 : 64;
+            band->entries = (seam_t*)realloc(band->entries, sizeof(seam_t)*(*size));
+        }
+        seam_t*seam = &band->entries[band->num_entries++];
+        memset(seam, 0, sizeof(seam_t));
+        seam->polygon_nr = polygon_nr;
+        seam->stroke = stroke;
+        seam->stroke_pos = l+1;
+        seam->segment = s;
+    }
+}
+
+static void band_start(band_t*band)
+{
+    status_t*status = &band->status;
+    int num = band->num_entries;
+    int t;
+
+    status->y = band->ymin - 1;
+    if (!num)
+        return;
+
+    qsort(band->entries, num, sizeof(seam_t), compare_seams);
+
+    seamorder_t*order = (seamorder_t*)malloc(sizeof(seamorder_t)*num);
+    for(t=0;t<num;t++) {
+        order[t].s = band->entries[t].segment;
+        order[t].y = band->ymin - 1;
+        order[t].s->seam = &band->entries[t];
+    }
+    qsort(order, num, sizeof(seamorder_t), compare_seamorder);
+    segment_t**segs = (segment_t**)malloc(sizeof(segment_t*)*num);
+    for(t=0;t<num;t++) {
+        segs[t] = order[t].s;
+    }
+    free(order);
+    actlist_fill(status->actlist, segs, num);
+    free(segs);
+
+    windstate_t wind = status->windrule->start(status->context);
+    segment_t*s = actlist_leftmost(status->actlist);
+    for(;s;s=s->right) {
+        s->wind = status->windrule->add(status->context, wind, s->fs, s->dir, s->polygon_nr);
+        s->fs_out = status->windrule->diff(status->context, &wind, &s->wind);
+        wind = s->wind;
+#ifdef CHECKS
+        s->fs_out_ok = 1;
+#endif
+        if (s->left)
+            schedule_crossing(status, s->left, s);
+        schedule_endpoint(status, s);
+    }
+}
+
+static int compare_stroke_end(const strokeend_t*e, point_t p, segment_dir_t dir, edgestyle_t*fs)
+{
+    int d;
+    if ((d = CMP(e->p.y, p.y))) return d;
+    if ((d = CMP(e->p.x, p.x))) return d;
+    if ((d = CMP(e->stroke->dir, dir))) return d;
+    return CMP((uintptr_t)e->stroke->fs, (uintptr_t)fs);
+}
+static int compare_stroke_ends(const void*_e1, const void*_e2)
+{
+    const strokeend_t*e1 = (const strokeend_t*)_e1;
+    const strokeend_t*e2 = (const strokeend_t*)_e2;
+    return compare_stroke_end(e1, e2->p, e2->stroke->dir, e2->stroke->fs);
+}
+
+/* find a stroke of this band which can be continued with an edge starting at p */
+static gfxsegmentlist_t* band_find_stroke_end(band_t*band, point_t p, segment_dir_t dir, edgestyle_t*fs)
+{
+    int l = 0, r = band->num_ends;
+    while (l < r) {
+        int m = (l+r)/2;
+        if (compare_stroke_end(&band->ends[m], p, dir, fs) < 0)
+            l = m+1;
+        else
+            r = m;
+    }
+    /* strokes which were merged into other strokes are empty now */
+    for(;l<band->num_ends;l++) {
+        if (compare_stroke_end(&band->ends[l], p, dir, fs))
+            break;
+        if (band->ends[l].stroke->num_points)
+            return band->ends[l].stroke;
+    }
+    return 0;
+}
+
+static void band_finish(band_t*band)
+{
+    status_t*status = &band->status;
+    int num = status->actlist->size;
+    band->exits = (seam_t*)malloc(sizeof(seam_t)*(num?num:1));
+    band->num_exits = 0;
+    segment_t*s = actlist_leftmost(status->actlist);
+    for(;s;s=s->right) {
+        seam_t*seam = &band->exits[band->num_exits++];
+        memset(seam, 0, sizeof(seam_t));
+        seam->polygon_nr = s->polygon_nr;
+        seam->stroke = s->stroke;
+        seam->stroke_pos = s->stroke_pos;
+        seam->from = s->seam;
+        seam->pos = s->pos;
+        seam->pos_band = band;
+    }
+    assert(band->num_exits == num);
+    qsort(band->exits, band->num_exits, sizeof(seam_t), compare_seams);
+
+    gfxsegmentlist_t*stroke;
+    band->num_ends = 0;
+    for(stroke=status->strokes;stroke;stroke=stroke->next) {
+        band->num_ends++;
+    }
+    band->ends = (strokeend_t*)malloc(sizeof(strokeend_t)*(band->num_ends+1));
+    num = 0;
+    for(stroke=status->strokes;stroke;stroke=stroke->next) {
+        band->ends[num].p = stroke->points[stroke->num_points-1];
+        band->ends[num].stroke = stroke;
+        num++;
+    }
+    qsort(band->ends, band->num_ends, sizeof(strokeend_t), compare_stroke_ends);
+}
+
+static void* band_sweep(void*_band)
+{
+    band_t*band = (band_t*)_band;
+    current_polygon = band->poly1;
+
+    status_t*status = &band->status;
+    status_init(status);
+    status_start(status, band->poly1, band->windrule, band->context);
+    int size = 0;
+    band_enqueue(band, band->poly1, 0, &size);
+    if (band->poly2)
+        band_enqueue(band, band->poly2, 1, &size);
+    band_start(band);
+
+    sweep(status, band->moments, band->ymin, band->ymax);
+
+    if (band->ymax < INT_MAX)
+        band_finish(band);
+    status_finish(status);
+    status_destroy(status);
+    current_polygon = 0;
+    return 0;
+}
+
+/* prepend the points of stroke "from" (which ends where "to" starts) to stroke "to" */
+static void stroke_join(status_t*status, gfxsegmentlist_t*from, gfxsegmentlist_t*to)
+{
+    int num = from->num_points + to->num_points - 1;
+    point_t*points = (point_t*)arena_alloc(status->arena, sizeof(point_t)*num);
+    memcpy(points, from->points, sizeof(point_t)*from->num_points);
+    memcpy(points+from->num_points, to->points+1, sizeof(point_t)*(to->num_points-1));
+    to->points = points;
+    to->num_points = to->points_size = num;
+    from->num_points = 0;
+}
+
+static void band_stitch(band_t*prev, band_t*band)
+{
+    assert(prev->num_exits == band->num_entries);
+    int t;
+    for(t=0;t<band->num_entries;t++) {
+        seam_t*exit = &prev->exits[t];
+        seam_t*entry = &band->entries[t];
+        assert(!compare_seams(exit, entry));
+        if (exit->from) {
+            /* passed through the previous band without a new point */
+            exit->pos = exit->from->pos;
+            exit->pos_band = exit->from->pos_band;
+        }
+        entry->pos = exit->pos;
+        entry->pos_band = exit->pos_band;
+
+        gfxsegmentlist_t*stroke = entry->first;
+        if (!stroke)
+            continue;
+        stroke->points[0] = entry->pos;
+
+        /* continue a stroke from a previous band, like append_stroke would have */
+        gfxsegmentlist_t*p = band_find_stroke_end(entry->pos_band, entry->pos, stroke->dir, stroke->fs);
+        if (p) {
+            stroke_join(&band->status, p, stroke);
+        }
+    }
+}
+
+static int compare_int32(const void*_a, const void*_b)
+{
+    int32_t a = *(const int32_t*)_a;
+    int32_t b = *(const int32_t*)_b;
+    return a<b ? -1 : (a>b);
+}
+
+/* choose band boundaries such that every band gets roughly the same number of points */
+static int choose_bands(gfxpoly_t*poly1, gfxpoly_t*poly2, int32_t*bounds, int num_bands)
+{
+    int total = gfxpoly_size(poly1) + (poly2?gfxpoly_size(poly2):0);
+    int step = total/4096 + 1;
+    int32_t*y = (int32_t*)malloc(sizeof(int32_t)*(total/step+2));
+    int num = 0, count = 0;
+    gfxpoly_t*polys[2] = {poly1, poly2};
+    int t,i;
+    for(t=0;t<2;t++) {
+        gfxsegmentlist_t*stroke = polys[t] ? polys[t]->strokes : 0;
+        for(;stroke;stroke=stroke->next) {
+            for(i=0;i<stroke->num_points-1;i++) {
+                if (count++ % step == 0)
+                    y[num++] = stroke->points[i].y;
+            }
+        }
+    }
+    if (!num) {
+        free(y);
+        return 1;
+    }
+    qsort(y, num, sizeof(int32_t), compare_int32);
+
+    int num_bounds = 0;
+    for(t=1;t<num_bands;t++) {
+        int32_t b = y[(int64_t)num*t/num_bands];
+        if (num_bounds ? b > bounds[num_bounds-1] : b > y[0])
+            bounds[num_bounds++] = b;
+    }
+    free(y);
+    return num_bounds+1;
+}
+
+gfxpoly_t* gfxpoly_process_parallel(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, moments_t*moments, int num_threads)
+{
+    if (poly2) {
+        assert(poly1->gridsize == poly2->gridsize);
+    }
+    if (num_threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = cpus > 0 ? (int)cpus : 1;
+    }
+    int32_t*bounds = (int32_t*)malloc(sizeof(int32_t)*num_threads);
+    int num_bands = num_threads > 1 ? choose_bands(poly1, poly2, bounds, num_threads) : 1;
+    if (num_bands <= 1) {
+        free(bounds);
+        return gfxpoly_process(poly1, poly2, windrule, context, moments);
+    }
+
+    band_t*bands = (band_t*)calloc(num_bands, sizeof(band_t));
+    moments_t*band_moments = moments ? (moments_t*)calloc(num_bands, sizeof(moments_t)) : 0;
+    int t,i,j;
+    for(t=0;t<num_bands;t++) {
+        band_t*band = &bands[t];
+        band->poly1 = poly1;
+        band->poly2 = poly2;
+        band->windrule = windrule;
+        band->context = context;
+        band->moments = moments ? &band_moments[t] : 0;
+        band->ymin = t ? bounds[t-1] : INT_MIN;
+        band->ymax = t<num_bands-1 ? bounds[t] : INT_MAX;
+    }
+    free(bounds);
+
+    /* band 0 is done by the calling thread */
+    pthread_t*threads = (pthread_t*)malloc(sizeof(pthread_t)*num_bands);
+    char*started = (char*)calloc(num_bands, 1);
+    for(t=1;t<num_bands;t++) {
+        started[t] = !pthread_create(&threads[t], 0, band_sweep, &bands[t]);
+    }
+    band_sweep(&bands[0]);
+    for(t=1;t<num_bands;t++) {
+        if (started[t])
+            pthread_join(threads[t], 0);
+        else
+            band_sweep(&bands[t]);
+    }
+    free(started);
+    free(threads);
+
+    for(t=1;t<num_bands;t++) {
+        band_stitch(&bands[t-1], &bands[t]);
+    }
+
+    if (moments) {
+        memset(moments, 0, sizeof(moments_t));
+        for(t=0;t<num_bands;t++) {
+            moments->area += band_moments[t].area;
+            for(i=0;i<3;i++)
+            for(j=0;j<3;j++) {
+                moments->m[i][j] += band_moments[t].m[i][j];
+            }
+        }
+        free(band_moments);
+    }
+
+    gfxpoly_t*p = (gfxpoly_t*)malloc(sizeof(gfxpoly_t));
+    p->gridsize = poly1->gridsize;
+    p->strokes = 0;
+    gfxsegmentlist_t**last = &p->strokes;
+    for(t=0;t<num_bands;t++) {
+        *last = strokes_from_arena(bands[t].status.strokes);
+        while (*last)
+            last = &(*last)->next;
+    }
+    for(t=0;t<num_bands;t++) {
+        arena_destroy(bands[t].status.arena);
+        free(bands[t].entries);
+        free(bands[t].exits);
+        free(bands[t].ends);
+    }
+    free(bands);
+    return p;
+}
+
+/* ------------------------------ incremental sweep ------------------------------
+
+   Keeps the bands of a parallel sweep around (without the stitching, which
+   modifies the bands' strokes). A band's sweep only depends on the strokes
+   crossing it, so after some strokes were replaced, only the bands they
+   cross need to be swept again. The result is put together from copies of
+   the bands' strokes, which are stitched like band_stitch does it.
+*/
+
+#define INCREMENTAL_BAND_SIZE 2048 // edges per band, if not specified
+
+struct _gfxpoly_incremental {
+    gfxpoly_t*polys[2];
+    band_t*bands;
+    int num_bands;
+};
+
+static void band_clear(band_t*band)
+{
+    if (band->status.arena)
+        arena_destroy(band->status.arena);
+    free(band->entries);
+    free(band->exits);
+    free(band->ends);
+    band->entries = band->exits = 0;
+    band->ends = 0;
+    band->num_entries = band->num_exits = band->num_ends = 0;
+}
+
+gfxpoly_incremental_t* gfxpoly_incremental_new(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, windcontext_t*context, int num_bands)
+{
+    if (poly2) {
+        assert(poly1->gridsize == poly2->gridsize);
+    }
+    if (num_bands <= 0) {
+        int size = gfxpoly_size(poly1) + (poly2?gfxpoly_size(poly2):0);
+        num_bands = size / INCREMENTAL_BAND_SIZE + 1;
+    }
+    int32_t*bounds = (int32_t*)malloc(sizeof(int32_t)*num_bands);
+    num_bands = num_bands > 1 ? choose_bands(poly1, poly2, bounds, num_bands) : 1;
+
+    gfxpoly_incremental_t*inc = (gfxpoly_incremental_t*)calloc(1, sizeof(gfxpoly_incremental_t));
+    inc->polys[0] = poly1;
+    inc->polys[1] = poly2;
+    inc->num_bands = num_bands;
+    inc->bands = (band_t*)calloc(num_bands, sizeof(band_t));
+    int t;
+    for(t=0;t<num_bands;t++) {
+        band_t*band = &inc->bands[t];
+        band->poly1 = poly1;
+        band->poly2 = poly2;
+        band->windrule = windrule;
+        band->context = context;
+        band->ymin = t ? bounds[t-1] : INT_MIN;
+        band->ymax = t<num_bands-1 ? bounds[t] : INT_MAX;
+        band_sweep(band);
+    }
+    free(bounds);
+    return inc;
+}
+
+/* marks the bands band_enqueue would hand stroke to */
+static void incremental_mark_bands(gfxpoly_incremental_t*inc, char*dirty, gfxsegmentlist_t*stroke)
+{
+    int32_t y1 = stroke->points[0].y;
+    int32_t y2 = stroke->points[stroke->num_points-1].y;
+    int l = 0, r = inc->num_bands;
+    while (l < r) {
+        int m = (l+r)/2;
+        if (inc->bands[m].ymax <= y1)
+            l = m+1;
+        else
+            r = m;
+    }
+    for(;l<inc->num_bands && inc->bands[l].ymin <= y2;l++) {
+        dirty[l] = 1;
+    }
+}
+
+void gfxpoly_incremental_update(gfxpoly_incremental_t*inc, int polygon_nr, gfxsegmentlist_t**removed, int num_removed, gfxsegmentlist_t*added)
+{
+    gfxpoly_t*poly = inc->polys[polygon_nr];
+    assert(poly);
+    char*dirty = (char*)calloc(inc->num_bands, 1);
+    dict_t*remove = dict_new(&ptr_type);
+    int t;
+    for(t=0;t<num_removed;t++) {
+        incremental_mark_bands(inc, dirty, removed[t]);
+        dict_put(remove, removed[t], 0);
+    }
+
+    gfxsegmentlist_t**last = &poly->strokes;
+    while (*last) {
+        gfxsegmentlist_t*stroke = *last;
+        if (dict_contains(remove, stroke)) {
+            *last = stroke->next;
+            free(stroke->points);
+            free(stroke);
+        } else {
+            last = &stroke->next;
+        }
+    }
+    dict_destroy(remove);
+
+    gfxsegmentlist_t*stroke = added;
+    for(;stroke;stroke=stroke->next) {
+        assert(stroke->num_points > 1);
+        incremental_mark_bands(inc, dirty, stroke);
+        if (!stroke->next) {
+            stroke->next = poly->strokes;
+            poly->strokes = added;
+            break;
+        }
+    }
+
+    /* Bands which none of the strokes cross don't see any of them, so their
+       seams with other untouched bands stay the same, too. */
+    for(t=0;t<inc->num_bands;t++) {
+        if (dirty[t]) {
+            band_clear(&inc->bands[t]);
+            band_sweep(&inc->bands[t]);
+        }
+    }
+    free(dirty);
+}
+
+static gfxsegmentlist_t* stroke_copy(gfxsegmentlist_t*stroke)
+{
+    gfxsegmentlist_t*s = (gfxsegmentlist_t*)malloc(sizeof(gfxsegmentlist_t));
+    *s = *stroke;
+    s->points_size = s->num_points;
+    s->points = (point_t*)malloc(sizeof(point_t)*s->num_points);
+    memcpy(s->points, stroke->points, sizeof(point_t)*s->num_points);
+    s->next = 0;
+    return s;
+}
+
+gfxpoly_t* gfxpoly_incremental_result(gfxpoly_incremental_t*inc)
+{
+    /* band strokes -> their copies in the result */
+    dict_t*copies = dict_new(&ptr_type);
+    int t, i;
+    for(t=0;t<inc->num_bands;t++) {
+        band_t*band = &inc->bands[t];
+        gfxsegmentlist_t*stroke;
+        for(stroke=band->status.strokes;stroke;stroke=stroke->next) {
+            if (stroke->num_points)
+                dict_put(copies, stroke, stroke_copy(stroke));
+        }
+    }
+
+    for(t=1;t<inc->num_bands;t++) {
+        band_t*prev = &inc->bands[t-1];
+        band_t*band = &inc->bands[t];
+        assert(prev->num_exits == band->num_entries);
+        for(i=0;i<band->num_entries;i++) {
+            seam_t*exit = &prev->exits[i];
+            seam_t*entry = &band->entries[i];
+            assert(!compare_seams(exit, entry));
+            if (exit->from) {
+                exit->pos = exit->from->pos;
+                exit->pos_band = exit->from->pos_band;
+            }
+            entry->pos = exit->pos;
+            entry->pos_band = exit->pos_band;
+            if (!entry->first)
+                continue;
+            gfxsegmentlist_t*to = (gfxsegmentlist_t*)dict_lookup(copies, entry->first);
+            to->points[0] = entry->pos;
+
+            /* find a stroke to continue, like band_find_stroke_end, but
+               skipping the strokes whose copies were merged already */
+            band_t*b = entry->pos_band;
+            int l = 0, r = b->num_ends;
+            while (l < r) {
+                int m = (l+r)/2;
+                if (compare_stroke_end(&b->ends[m], entry->pos, to->dir, to->fs) < 0)
+                    l = m+1;
+                else
+                    r = m;
+            }
+            for(;l<b->num_ends;l++) {
+                if (compare_stroke_end(&b->ends[l], entry->pos, to->dir, to->fs))
+                    break;
+                gfxsegmentlist_t*from = (gfxsegmentlist_t*)dict_lookup(copies, b->ends[l].stroke);
+                if (from && from->num_points && from != to) {
+                    int num = from->num_points + to->num_points - 1;
+                    from->points = (point_t*)realloc(from->points, sizeof(point_t)*num);
+                    memcpy(from->points+from->num_points, to->points+1, sizeof(point_t)*(to->num_points-1));
+                    free(to->points);
+                    to->points = from->points;
+                    to->num_points = to->points_size = num;
+                    from->points = 0;
+                    from->num_points = 0;
+                    break;
+                }
+            }
+        }
+    }
+
+    gfxpoly_t*p = (gfxpoly_t*)malloc(sizeof(gfxpoly_t));
+    p->gridsize = inc->polys[0]->gridsize;
+    gfxsegmentlist_t**last = &p->strokes;
+    for(t=0;t<inc->num_bands;t++) {
+        gfxsegmentlist_t*stroke;
+        for(stroke=inc->bands[t].status.strokes;stroke;stroke=stroke->next) {
+            gfxsegmentlist_t*s = (gfxsegmentlist_t*)dict_lookup(copies, stroke);
+            if (!s)
+                continue;
+            if (!s->num_points) {
+                free(s);
+                continue;
+            }
+            *last = s;
+            last = &s->next;
+        }
+    }
+    *last = 0;
+    dict_destroy(copies);
+    return p;
+}
+
+void gfxpoly_incremental_destroy(gfxpoly_incremental_t*inc)
+{
+    int t;
+    for(t=0;t<inc->num_bands;t++) {
+        band_clear(&inc->bands[t]);
+    }
+    free(inc->bands);
+    free(inc);
+}
+
+/* ------------------------------ bounding box shortcuts ------------------------------ */
+
+/* Both operands of the boolean operators are filled even/odd, so the fill on
+   a scanline only depends on the strokes crossing that scanline. Where a
+   windrule never fills anything outside of the other operand (p1 and p2 for
+   an intersection, p2 for a subtraction), strokes lying entirely above or
+   below the other operand's bbox only contribute to scanlines on which the
+   result is empty, and can be left out of the sweep. Strokes which the
+   result does contain always go through the sweep, so that the output is
+   the same as gfxpoly_process() would produce. */
+
+typedef struct _gridbbox {
+    int32_t xmin, ymin, xmax, ymax;
+} gridbbox_t;
+
+static char grid_bbox(gfxpoly_t*poly, gridbbox_t*b)
+{
+    char empty = 1;
+    gfxsegmentlist_t*stroke;
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        int s;
+        for(s=0;s<stroke->num_points;s++) {
+            point_t p = stroke->points[s];
+            if (empty) {
+                b->xmin = b->xmax = p.x;
+                b->ymin = b->ymax = p.y;
+                empty = 0;
+                continue;
+            }
+            if (p.x < b->xmin) b->xmin = p.x;
+            if (p.y < b->ymin) b->ymin = p.y;
+            if (p.x > b->xmax) b->xmax = p.x;
+            if (p.y > b->ymax) b->ymax = p.y;
+        }
+    }
+    return !empty;
+}
+
+static inline char stroke_misses_scanlines(gfxsegmentlist_t*stroke, gridbbox_t*b)
+{
+    /* strokes are monotone in y */
+    return stroke->points[stroke->num_points-1].y < b->ymin ||
+           stroke->points[0].y > b->ymax;
+}
+
+/* Fills swept with (shallow copies of) the strokes of poly which cross the
+   scanlines of box. */
+static void filter_strokes(gfxpoly_t*poly, gridbbox_t*box, gfxpoly_t*swept)
+{
+    swept->gridsize = poly->gridsize;
+    swept->strokes = 0;
+    gfxsegmentlist_t**swept_last = &swept->strokes;
+    gfxsegmentlist_t*stroke;
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        if (stroke_misses_scanlines(stroke, box))
+            continue;
+        gfxsegmentlist_t*s = (gfxsegmentlist_t*)malloc(sizeof(gfxsegmentlist_t));
+        *s = *stroke;
+        s->next = 0;
+        *swept_last = s;
+        swept_last = &s->next;
+    }
+}
+
+static void free_shallow_strokes(gfxsegmentlist_t*stroke)
+{
+    while (stroke) {
+        gfxsegmentlist_t*next = stroke->next;
+        free(stroke);
+        stroke = next;
+    }
+}
+
+/* Processes p1 and p2 with a windrule that never fills anything outside of
+   p2 (and, if both_inside is set, outside of p1 either) */
+static gfxpoly_t* process_with_bbox(gfxpoly_t*p1, gfxpoly_t*p2, windrule_t*windrule, char both_inside)
+{
+    assert(p1->gridsize == p2->gridsize);
+    gridbbox_t b1, b2;
+    char has1 = grid_bbox(p1, &b1);
+    char has2 = grid_bbox(p2, &b2);
+    if (both_inside && (!has1 || !has2 ||
+        b1.xmax < b2.xmin || b2.xmax < b1.xmin ||
+        b1.ymax < b2.ymin || b2.ymax < b1.ymin)) {
+        /* the bounding boxes are disjoint, so the result is empty */
+        gfxpoly_t*p = (gfxpoly_t*)malloc(sizeof(gfxpoly_t));
+        p->gridsize = p1->gridsize;
+        p->strokes = 0;
+        return p;
+    }
+    if (!has1)
+        return gfxpoly_process(p1, p2, windrule, &twopolygons, NULL);
+
+    gfxpoly_t swept1, swept2;
+    filter_strokes(p2, &b1, &swept2);
+    if (both_inside)
+        filter_strokes(p1, &b2, &swept1);
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    engine->status.fix_windings = 1;
+    engine->status.fix_windings_y = both_inside ? max32(b1.ymin, b2.ymin) : b1.ymin;
+    gfxpoly_t*p = gfxpoly_engine_process(engine, both_inside ? &swept1 : p1, &swept2, windrule, &twopolygons, NULL);
+    gfxpoly_engine_destroy(engine);
+    if (both_inside)
+        free_shallow_strokes(swept1.strokes);
+    free_shallow_strokes(swept2.strokes);
+    return p;
+}
+
+gfxpoly_t* gfxpoly_intersect(gfxpoly_t*p1, gfxpoly_t*p2)
+{
+    return process_with_bbox(p1, p2, &windrule_intersect, 1);
+}
+gfxpoly_t* gfxpoly_union(gfxpoly_t*p1, gfxpoly_t*p2)
+{
+    return gfxpoly_process(p1, p2, &windrule_union, &twopolygons, NULL);
+}
+gfxpoly_t* gfxpoly_subtract(gfxpoly_t*p1, gfxpoly_t*p2)
+{
+    return process_with_bbox(p1, p2, &windrule_subtract, 0);
+}
+
+/* ------------------------------ predicates ------------------------------ */
+
+/* Sweeps poly1 and poly2 until an area with windrule gets filled. Strokes
+   of poly2 that are outside of poly1's scanlines (and the other way round,
+   unless keep1 is set) are left out, which is correct if windrule never
+   fills anything outside of poly1 (or poly2). */
+static char sweep_until_filled(gfxpoly_t*poly1, gfxpoly_t*poly2, windrule_t*windrule, char keep1, char*contact)
+{
+    gridbbox_t b1, b2;
+    if (!grid_bbox(poly1, &b1) || !grid_bbox(poly2, &b2)) {
+        if (contact)
+            *contact = 0;
+        /* poly1 might still have some area */
+        if (!keep1)
+            return 0;
+        b1.ymin = b2.ymin = INT_MIN;
+        b1.ymax = b2.ymax = INT_MAX;
+    }
+    if (!keep1 && (b1.xmax < b2.xmin || b2.xmax < b1.xmin)) {
+        if (contact)
+            *contact = 0;
+        return 0;
+    }
+
+    gfxpoly_t swept1, swept2;
+    if (!keep1)
+        filter_strokes(poly1, &b2, &swept1);
+    filter_strokes(poly2, &b1, &swept2);
+
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    status_t*status = &engine->status;
+    status->measure_only = 1;
+    status->measure_perimeter = 0;
+    status->stop_at_fill = 1;
+    status->check_contact = contact != 0;
+    status->fix_windings = 1;
+    status->fix_windings_y = keep1 ? b1.ymin : max32(b1.ymin, b2.ymin);
+    current_polygon = poly1;
+    engine_sweep(engine, keep1 ? poly1 : &swept1, &swept2, windrule, &twopolygons, 0);
+    current_polygon = 0;
+    char filled = status->filled;
+    if (contact)
+        *contact = status->contact;
+    gfxpoly_engine_destroy(engine);
+
+    if (!keep1)
+        free_shallow_strokes(swept1.strokes);
+    free_shallow_strokes(swept2.strokes);
+    return filled;
+}
+
+char gfxpoly_intersects(gfxpoly_t*p1, gfxpoly_t*p2)
+{
+    return sweep_until_filled(p1, p2, &windrule_intersect, 0, 0);
+}
+
+char gfxpoly_contains(gfxpoly_t*p1, gfxpoly_t*p2)
+{
+    /* p2 is inside p1 if nothing of p2 is left after subtracting p1 */
+    return !sweep_until_filled(p2, p1, &windrule_subtract, 1, 0);
+}
+
+char gfxpoly_touches(gfxpoly_t*p1, gfxpoly_t*p2)
+{
+    char contact;
+    if (sweep_until_filled(p1, p2, &windrule_intersect, 0, &contact))
+        return 0;
+    return contact;
+}
+/* ------------------------------ masks ------------------------------ */
+
+/* A mask holds the start events of all its strokes, created and sorted
+   once. Clipping a polygon against the mask only needs to sort the events
+   of the polygon, and merge them with the slice of the mask's events that
+   lies within the polygon's scanlines. Mask strokes which start above
+   the polygon and reach into it are found through an index of buckets
+   of scanlines, and enter the sweep at their first segment reaching the
+   polygon's top scanline. The sweep stops after the polygon's bottom
+   scanline. */
+
+typedef struct _maskevent {
+    uint64_t key;
+    point_t p;
+    eventtype_t type;
+    gfxsegmentlist_t*stroke;
+    int pos;
+    char last; // last event of its stroke (see advance_stroke)
+} maskevent_t;
+
+struct _gfxpoly_mask {
+    double gridsize;
+    gridbbox_t bbox;
+
+    /* the first events of all the strokes, in sweep order */
+    maskevent_t*events;
+    int num_events;
+
+    /* all the strokes, sorted by their top y */
+    gfxsegmentlist_t**strokes;
+    int num_strokes;
+
+    /* the strokes crossing the top of every bucket of scanlines (i.e.,
+       starting above it and ending on or below it) */
+    int32_t bucket_height;
+    int num_buckets;
+    int*bucket_pos;
+    gfxsegmentlist_t**crossing;
+};
+
+#define STROKE_TOP(s) ((s)->points[0].y)
+#define STROKE_BOTTOM(s) ((s)->points[(s)->num_points-1].y)
+
+static int compare_stroke_tops(const void*_s1, const void*_s2)
+{
+    gfxsegmentlist_t*s1 = *(gfxsegmentlist_t**)_s1;
+    gfxsegmentlist_t*s2 = *(gfxsegmentlist_t**)_s2;
+    return CMP(STROKE_TOP(s1), STROKE_TOP(s2));
+}
+
+static int mask_bucket(gfxpoly_mask_t*mask, int32_t y)
+{
+    return ((int64_t)y - mask->bbox.ymin) / mask->bucket_height;
+}
+
+static void mask_build_buckets(gfxpoly_mask_t*mask)
+{
+    int64_t height = (int64_t)mask->bbox.ymax - mask->bbox.ymin + 1;
+    mask->num_buckets = (int)sqrt(mask->num_strokes) + 1;
+    mask->bucket_height = (height + mask->num_buckets - 1) / mask->num_buckets;
+    mask->num_buckets = (height + mask->bucket_height - 1) / mask->bucket_height;
+    mask->bucket_pos = (int*)calloc(mask->num_buckets + 1, sizeof(int));
+
+    /* two passes: count, then fill */
+    int pass, t, b;
+    for(pass=0;pass<2;pass++) {
+        for(t=0;t<mask->num_strokes;t++) {
+            gfxsegmentlist_t*stroke = mask->strokes[t];
+            int b1 = mask_bucket(mask, STROKE_TOP(stroke)) + 1;
+            int b2 = mask_bucket(mask, STROKE_BOTTOM(stroke));
+            for(b=b1;b<=b2;b++) {
+                if (pass == 0)
+                    mask->bucket_pos[b+1]++;
+                else
+                    mask->crossing[mask->bucket_pos[b]++] = stroke;
+            }
+        }
+        if (pass == 0) {
+            for(b=0;b<mask->num_buckets;b++)
+                mask->bucket_pos[b+1] += mask->bucket_pos[b];
+            mask->crossing = (gfxsegmentlist_t**)malloc(sizeof(gfxsegmentlist_t*)*(mask->bucket_pos[mask->num_buckets]+1));
+        } else {
+            /* the fill loop advanced every position to the next bucket's */
+            for(b=mask->num_buckets;b>0;b--)
+                mask->bucket_pos[b] = mask->bucket_pos[b-1];
+            mask->bucket_pos[0] = 0;
+        }
+    }
+}
+
+gfxpoly_mask_t* gfxpoly_mask_new(gfxpoly_t*poly)
+{
+    gfxpoly_mask_t*mask = (gfxpoly_mask_t*)calloc(1, sizeof(gfxpoly_mask_t));
+    mask->gridsize = poly->gridsize;
+    if (!grid_bbox(poly, &mask->bbox))
+        return mask;
+
+    mask->num_strokes = gfxpoly_num_segments(poly);
+    mask->strokes = (gfxsegmentlist_t**)malloc(sizeof(gfxsegmentlist_t*)*mask->num_strokes);
+    gfxsegmentlist_t*stroke;
+    int t = 0;
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        mask->strokes[t++] = stroke;
+    }
+    qsort(mask->strokes, mask->num_strokes, sizeof(gfxsegmentlist_t*), compare_stroke_tops);
+    mask_build_buckets(mask);
+
+    /* Let the sweep create and sort the start events, and map them back to
+       their strokes via the segment numbers. The mask is polygon 1, like the
+       second operand of gfxpoly_intersect. */
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    status_t*status = &engine->status;
+    status_start(status, poly, &windrule_intersect, &twopolygons);
+    maskevent_t*origin = (maskevent_t*)malloc(sizeof(maskevent_t)*gfxpoly_size(poly));
+    for(stroke=poly->strokes;stroke;stroke=stroke->next) {
+        int first = status->starts.num;
+        advance_stroke(status, stroke, 1, 0, 1);
+        for(t=first;t<status->starts.num;t++) {
+            maskevent_t*m = &origin[status->starts.events[t].s1->nr];
+            m->stroke = stroke;
+            m->pos = t - first;
+            m->last = t == status->starts.num-1;
+        }
+    }
+    events_sort(&status->starts);
+    mask->num_events = status->starts.num;
+    mask->events = (maskevent_t*)malloc(sizeof(maskevent_t)*mask->num_events);
+    for(t=0;t<mask->num_events;t++) {
+        event_t*e = &status->starts.events[t];
+        maskevent_t*m = &mask->events[t];
+        *m = origin[e->s1->nr];
+        m->key = e->key;
+        m->p = e->p;
+        m->type = e->type;
+    }
+    free(origin);
+    status_finish(status);
+    gfxpoly_engine_destroy(engine);
+    return mask;
+}
+
+void gfxpoly_mask_destroy(gfxpoly_mask_t*mask)
+{
+    free(mask->events);
+    free(mask->strokes);
+    free(mask->bucket_pos);
+    free(mask->crossing);
+    free(mask);
+}
+
+/* schedule the segment of a mask stroke which crosses scanline y
+   (or ends on it) */
+static void mask_enter_stroke(status_t*status, gfxsegmentlist_t*stroke, int32_t y)
+{
+    int lo = 0, hi = stroke->num_points-2;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (stroke->points[mid+1].y >= y)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    advance_stroke(status, stroke, 1, lo, 1);
+}
+
+/* index of the first mask event with p.y >= y */
+static int mask_find_event(gfxpoly_mask_t*mask, int32_t y)
+{
+    int lo = 0, hi = mask->num_events;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (mask->events[mid].p.y >= y)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/* merge the sorted start events [0,split) and [split,num) */
+static void events_merge(eventlist_t*l, int split)
+{
+    l->tmp = (event_t*)realloc(l->tmp, sizeof(event_t)*l->size);
+    event_t*a = l->events, *a_end = l->events + split;
+    event_t*b = a_end, *b_end = l->events + l->num;
+    event_t*to = l->tmp;
+    while (a < a_end && b < b_end) {
+        if (COMPARE_EVENTS(b, a))
+            *to++ = *b++;
+        else
+            *to++ = *a++;
+    }
+    while (a < a_end)
+        *to++ = *a++;
+    while (b < b_end)
+        *to++ = *b++;
+    event_t*swap = l->events; l->events = l->tmp; l->tmp = swap;
+}
+
+static void mask_enqueue(gfxpoly_mask_t*mask, status_t*status, gridbbox_t*box)
+{
+    int t;
+    /* strokes coming in from above */
+    if (box->ymin > mask->bbox.ymin) {
+        int b = mask_bucket(mask, box->ymin);
+        if (b >= mask->num_buckets)
+            b = mask->num_buckets-1;
+        for(t=mask->bucket_pos[b];t<mask->bucket_pos[b+1];t++) {
+            gfxsegmentlist_t*stroke = mask->crossing[t];
+            if (STROKE_BOTTOM(stroke) >= box->ymin)
+                mask_enter_stroke(status, stroke, box->ymin);
+        }
+        int32_t bucket_top = mask->bbox.ymin + b * mask->bucket_height;
+        int lo = 0, hi = mask->num_strokes;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (STROKE_TOP(mask->strokes[mid]) >= bucket_top)
+                hi = mid;
+            else
+                lo = mid + 1;
+        }
+        for(t=lo;t<mask->num_strokes && STROKE_TOP(mask->strokes[t]) < box->ymin;t++) {
+            gfxsegmentlist_t*stroke = mask->strokes[t];
+            if (STROKE_BOTTOM(stroke) >= box->ymin)
+                mask_enter_stroke(status, stroke, box->ymin);
+        }
+    }
+    events_sort(&status->starts);
+
+    /* strokes starting within the box. Their events are in sweep order
+       already. */
+    int split = status->starts.num;
+    int end = mask_find_event(mask, box->ymax + 1);
+    for(t=mask_find_event(mask, box->ymin);t<end;t++) {
+        maskevent_t*m = &mask->events[t];
+        gfxsegmentlist_t*stroke = m->stroke;
+        segment_t*s = segment_new(status, stroke->points[m->pos], stroke->points[m->pos+1], 1, stroke->dir);
+        s->fs = stroke->fs;
+        if (m->last) {
+            s->stroke = stroke;
+            s->stroke_pos = m->pos + 1;
+        }
+        event_schedule_start(status, m->type, m->p, s);
+        assert(status->starts.events[status->starts.num-1].key == m->key);
+    }
+    events_merge(&status->starts, split);
+    status->starts.sorted = 1;
+}
+
+gfxpoly_t* gfxpoly_engine_clip(gfxpoly_engine_t*engine, gfxpoly_mask_t*mask, gfxpoly_t*poly)
+{
+    assert(poly->gridsize == mask->gridsize);
+    gfxpoly_t*p = (gfxpoly_t*)malloc(sizeof(gfxpoly_t));
+    p->gridsize = poly->gridsize;
+    p->strokes = 0;
+
+    gridbbox_t box;
+    if (!mask->num_events || !grid_bbox(poly, &box) ||
+        box.xmax < mask->bbox.xmin || mask->bbox.xmax < box.xmin ||
+        box.ymax < mask->bbox.ymin || mask->bbox.ymax < box.ymin) {
+        return p;
+    }
+
+    current_polygon = poly;
+    status_t*status = &engine->status;
+    status->measure_only = 0;
+    status->stop_at_fill = status->check_contact = 0;
+    status_start(status, poly, &windrule_intersect, &twopolygons);
+
+    gfxpoly_t swept;
+    filter_strokes(poly, &mask->bbox, &swept);
+    gfxpoly_enqueue(&swept, status, /*polygon nr*/0);
+    mask_enqueue(mask, status, &box);
+    status->fix_windings = 1;
+    status->fix_windings_y = max32(box.ymin, mask->bbox.ymin);
+
+    /* nothing is filled below the polygon */
+    sweep(status, 0, INT_MIN, box.ymax + 1);
+    status_finish(status);
+    free_shallow_strokes(swept.strokes);
+
+    p->strokes = strokes_from_arena(status->strokes);
+    engine_recycle(engine);
+    current_polygon = 0;
+    return p;
+}
+
+gfxpoly_t* gfxpoly_clip(gfxpoly_mask_t*mask, gfxpoly_t*poly)
+{
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    gfxpoly_t*p = gfxpoly_engine_clip(engine, mask, poly);
+    gfxpoly_engine_destroy(engine);
+    return p;
+}
+
+gfxpoly_t* gfxpoly_union_many(gfxpoly_t**polys, int n)
+{
+    if (n <= 0)
+        return 0;
+    /* The results of the sweep have winding number 1 inside (see
+       insert_point_into_segment), so once every operand has been through
+       the sweep on its own, the number of operands covering an area is its
+       winding number. A bitmask windrule like windrule_union would limit n
+       to the bits of wind_nr. */
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    gfxpoly_t**normalized = (gfxpoly_t**)malloc(sizeof(gfxpoly_t*)*n);
+    int t;
+    for(t=0;t<n;t++) {
+        normalized[t] = gfxpoly_engine_process(engine, polys[t], NULL, &windrule_evenodd, &onepolygon, NULL);
+    }
+    windcontext_t context = {NULL, n};
+    gfxpoly_t*p = engine_process_many(engine, normalized, n, &windrule_circular, &context, NULL);
+    gfxpoly_engine_destroy(engine);
+    for(t=0;t<n;t++) {
+        gfxpoly_destroy(normalized[t]);
+    }
+    free(normalized);
+    return p;
+}
+
+gfxpoly_t* gfxpoly_selfintersect_evenodd(gfxpoly_t*p)
+{
+    return gfxpoly_process(p, NULL, &windrule_evenodd, &onepolygon, NULL);
+}
+gfxpoly_t* gfxpoly_selfintersect_circular(gfxpoly_t*p)
+{
+    return gfxpoly_process(p, NULL, &windrule_circular, &onepolygon, NULL);
+}
+
+
+gfxbbox_t gfxpoly_packed_calculate_bbox(gfxpoly_packed_t*poly)
+{
+    gfxbbox_t bbox = {0,0,0,0};
+    if (!poly->num_points)
+        return bbox;
+    int32_t x1 = poly->points[0].x, x2 = x1;
+    int32_t y1 = poly->points[0].y, y2 = y1;
+    int t;
+    for(t=1;t<poly->num_points;t++) {
+        point_t p = poly->points[t];
+        x1 = min32(x1, p.x);
+        y1 = min32(y1, p.y);
+        x2 = max32(x2, p.x);
+        y2 = max32(y2, p.y);
+    }
+    bbox.x1 = x1 * poly->gridsize;
+    bbox.y1 = y1 * poly->gridsize;
+    bbox.x2 = x2 * poly->gridsize;
+    bbox.y2 = y2 * poly->gridsize;
+    return bbox;
+}
 
 gfxbbox_t gfxpoly_calculate_bbox(gfxpoly_t*poly)
 {
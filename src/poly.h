@@ -45,7 +45,7 @@ typedef enum {SLOPE_POSITIVE, SLOPE_NEGATIVE} slope_t;
 
 #define INVALID_COORD (0x7fffffff)
 #define SEGNR(s) ((int)((s)?(s)->nr:-1))
-type_t point_type;
+extern type_t point_type;
 
 typedef struct _segment {
     point_t a;
@@ -65,20 +65,37 @@ typedef struct _segment {
     windstate_t wind;
     uintptr_t nr;
 
+    /* position in the active list's index (see active.h) */
+    union {
 #ifdef SPLAY
-    struct _segment*parent;
-    struct _segment*leftchild;
-    struct _segment*rightchild;
+        struct {
+            struct _segment*parent;
+            struct _segment*leftchild;
+            struct _segment*rightchild;
+        };
 #endif
+        struct _actblock*block;
+        struct _skipnode*skipnode;
+    };
     struct _segment*left;
     struct _segment*right;
     char changed;
 
     point_t pos;
 
+    /* hot pixel snapping: x at the top of the current scanline reached by the
+       positively sloped segments right of this one, and by the negatively sloped
+       segments left of it (see compute_scanline_reach) */
+    double reach_left;
+    double reach_right;
+
     gfxsegmentlist_t*stroke;
     int stroke_pos;
 
+    /* parallel sweep: set for segments coming in from a previous band until
+       they receive their first point */
+    struct _seam*seam;
+
 #ifndef DONT_REMEMBER_CROSSINGS
     dict_t scheduled_crossings;
 #endif
@@ -0,0 +1,183 @@
+/* query.c
+
+Point queries on prepared polygons
+
+Copyright (c) 2012 Matthias Kramm <kramm@quiss.org>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE. */
+
+#include <stdlib.h>
+#include <memory.h>
+#include "query.h"
+
+/* slabs with at most this many edges are searched linearly. The loop
+   doesn't branch, so the compiler can vectorize it. */
+#define LINEAR_SEARCH_MAX 32
+
+typedef struct _queryslab {
+    int32_t y1, y2;
+    int pos; // of the first edge
+    int num;
+} queryslab_t;
+
+struct _gfxpoly_prepared {
+    double gridsize;
+    windrule_t*windrule;
+    windcontext_t*context;
+    windstate_t outside;
+
+    queryslab_t*slabs;
+    int num_slabs;
+    int slabs_size;
+
+    /* for every slab, its edges from left to right: x at the top of the
+       slab, the slope, and the windstate right of the edge */
+    double*x;
+    double*dx;
+    windstate_t*wind;
+    int num_edges;
+    int edges_size;
+};
+
+gfxpoly_prepared_t* prepared_new(double gridsize, windrule_t*windrule, windcontext_t*context)
+{
+    gfxpoly_prepared_t*p = (gfxpoly_prepared_t*)calloc(1, sizeof(gfxpoly_prepared_t));
+    p->gridsize = gridsize;
+    p->windrule = windrule;
+    p->context = context;
+    p->outside = windrule->start(context);
+    return p;
+}
+
+void prepared_add_slab(gfxpoly_prepared_t*p, actlist_t*actlist, int32_t y1, int32_t y2)
+{
+    segment_t*s = actlist_leftmost(actlist);
+    if (!s)
+        return;
+    if (p->num_slabs == p->slabs_size) {
+        p->slabs_size = p->slabs_size ? p->slabs_size*2 : 64;
+        p->slabs = (queryslab_t*)realloc(p->slabs, sizeof(queryslab_t)*p->slabs_size);
+    }
+    queryslab_t*slab = &p->slabs[p->num_slabs++];
+    slab->y1 = y1;
+    slab->y2 = y2;
+    slab->pos = p->num_edges;
+    for(;s;s=s->right) {
+        if (p->num_edges == p->edges_size) {
+            p->edges_size = p->edges_size ? p->edges_size*2 : 256;
+            p->x = (double*)realloc(p->x, sizeof(double)*p->edges_size);
+            p->dx = (double*)realloc(p->dx, sizeof(double)*p->edges_size);
+            p->wind = (windstate_t*)realloc(p->wind, sizeof(windstate_t)*p->edges_size);
+        }
+        p->x[p->num_edges] = XPOS(s, y1);
+        p->dx[p->num_edges] = (double)s->delta.x / s->delta.y;
+        p->wind[p->num_edges] = s->wind;
+        p->num_edges++;
+    }
+    slab->num = p->num_edges - slab->pos;
+}
+
+/* returns the slab containing scanline y (in grid coordinates), or 0 */
+static queryslab_t* find_slab(gfxpoly_prepared_t*p, double y)
+{
+    int min = 0, max = p->num_slabs;
+    while (min < max) {
+        int i = (min+max)/2;
+        if (y < p->slabs[i].y1)
+            max = i;
+        else
+            min = i+1;
+    }
+    if (!min || y >= p->slabs[min-1].y2)
+        return 0;
+    return &p->slabs[min-1];
+}
+
+/* number of edges of the slab left of (x,y) */
+static inline int edges_left_of(gfxpoly_prepared_t*p, queryslab_t*slab, double x, double y)
+{
+    const double*ex = p->x + slab->pos;
+    const double*edx = p->dx + slab->pos;
+    double dy = y - slab->y1;
+    int num = slab->num;
+    if (num <= LINEAR_SEARCH_MAX) {
+        int t, count = 0;
+        for(t=0;t<num;t++) {
+            count += ex[t] + edx[t]*dy < x;
+        }
+        return count;
+    }
+    /* edges don't cross inside a slab, so they're sorted at every y */
+    int min = 0, max = num;
+    while (min < max) {
+        int i = (min+max)/2;
+        if (ex[i] + edx[i]*dy < x)
+            min = i+1;
+        else
+            max = i;
+    }
+    return min;
+}
+
+static inline windstate_t query(gfxpoly_prepared_t*p, queryslab_t*slab, double x, double y)
+{
+    if (!slab)
+        return p->outside;
+    int left = edges_left_of(p, slab, x, y);
+    return left ? p->wind[slab->pos + left - 1] : p->outside;
+}
+
+windstate_t gfxpoly_prepared_query(gfxpoly_prepared_t*p, gfxcoord_t x, gfxcoord_t y)
+{
+    double z = 1.0 / p->gridsize;
+    return query(p, find_slab(p, y*z), x*z, y*z);
+}
+
+char gfxpoly_prepared_contains(gfxpoly_prepared_t*p, gfxcoord_t x, gfxcoord_t y)
+{
+    return gfxpoly_prepared_query(p, x, y).is_filled;
+}
+
+void gfxpoly_prepared_query_batch(gfxpoly_prepared_t*p, const gfxcoord_t*x, const gfxcoord_t*y, int num, windstate_t*result)
+{
+    double z = 1.0 / p->gridsize;
+    queryslab_t*slab = 0;
+    int t;
+    for(t=0;t<num;t++) {
+        double gx = x[t]*z;
+        double gy = y[t]*z;
+        /* points usually come in rows, so try the previous slab first */
+        if (!slab || gy < slab->y1 || gy >= slab->y2)
+            slab = find_slab(p, gy);
+        result[t] = query(p, slab, gx, gy);
+    }
+}
+
+void gfxpoly_prepared_destroy(gfxpoly_prepared_t*p)
+{
+    free(p->slabs);
+    free(p->x);
+    free(p->dx);
+    free(p->wind);
+    free(p);
+}
@@ -0,0 +1,88 @@
+/* sort.h
+
+Sorting small records by an integer key
+
+Copyright (c) 2012 Matthias Kramm <kramm@quiss.org>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE. */
+
+#ifndef __sort_h__
+#define __sort_h__
+
+#include <stdint.h>
+#include <string.h>
+
+/* Stable sort of an array of t by a signed 32 bit key. Short arrays (and the
+   sweep's arrays are usually short, and often almost sorted already) are
+   insertion sorted, longer ones go through an LSD radix sort, one byte per
+   pass. Passes in which all keys have the same byte are skipped, so keys from
+   a narrow range only cost one or two passes.
+   tmp needs room for n elements if n > SORT_INSERTION_MAX. */
+#define SORT_INSERTION_MAX 48
+#define SORT_RADIX_KEY(k) ((uint32_t)(k)^0x80000000u)
+
+#define SORT_DEFINE(name,t,key)                                        \
+static void name##_sort(t*a, int n, t*tmp)                             \
+{                                                                      \
+    int i, j;                                                          \
+    if (n <= SORT_INSERTION_MAX) {                                     \
+        for(i=1;i<n;i++) {                                             \
+            t e = a[i];                                                \
+            for(j=i;j>0 && key(a[j-1]) > key(e);j--)                   \
+                a[j] = a[j-1];                                         \
+            a[j] = e;                                                  \
+        }                                                              \
+        return;                                                        \
+    }                                                                  \
+    int count[4][256];                                                 \
+    memset(count, 0, sizeof(count));                                   \
+    for(i=0;i<n;i++) {                                                 \
+        uint32_t k = SORT_RADIX_KEY(key(a[i]));                        \
+        count[0][k&255]++;                                             \
+        count[1][(k>>8)&255]++;                                        \
+        count[2][(k>>16)&255]++;                                       \
+        count[3][k>>24]++;                                             \
+    }                                                                  \
+    t*from = a, *to = tmp;                                             \
+    int pass;                                                          \
+    for(pass=0;pass<4;pass++) {                                        \
+        int shift = pass*8;                                            \
+        int*c = count[pass];                                           \
+        if (c[(SORT_RADIX_KEY(key(a[0]))>>shift)&255] == n)            \
+            continue;                                                  \
+        int sum = 0;                                                   \
+        for(i=0;i<256;i++) {                                           \
+            int s = c[i];                                              \
+            c[i] = sum;                                                \
+            sum += s;                                                  \
+        }                                                              \
+        for(i=0;i<n;i++) {                                             \
+            to[c[(SORT_RADIX_KEY(key(from[i]))>>shift)&255]++] = from[i]; \
+        }                                                              \
+        t*swap = from; from = to; to = swap;                           \
+    }                                                                  \
+    if (from != a)                                                     \
+        memcpy(a, from, sizeof(t)*n);                                  \
+}
+
+#endif
@@ -30,6 +30,7 @@ POSSIBILITY OF SUCH DAMAGE. */
 #include <stdio.h>
 #include <memory.h>
 #include "xrow.h"
+#include "sort.h"
 #include "poly.h"
 
 xrow_t* xrow_new()
@@ -52,22 +53,36 @@ void xrow_add(xrow_t*r, int32_t x)
     r->x[r->num++]=x;
 }
 
-int compare_int32(const void*_i1,const void*_i2)
-{
-    int32_t*i1 = (int32_t*)_i1;
-    int32_t*i2 = (int32_t*)_i2;
-    return *i1-*i2;
-}
+#define INT32_KEY(x) (x)
+SORT_DEFINE(int32,int32_t,INT32_KEY)
 
 void xrow_sort(xrow_t*r)
 {
-    if (!r->num)
+    int t, pos;
+    if (r->num <= SORT_INSERTION_MAX) {
+        /* xrow_add only drops consecutive duplicates. Drop the rest while
+           insertion sorting. */
+        for(t=0,pos=0;t<r->num;t++) {
+            int32_t x = r->x[t];
+            int j = pos;
+            while (j>0 && r->x[j-1] > x)
+                j--;
+            if (j>0 && r->x[j-1] == x)
+                continue;
+            memmove(&r->x[j+1], &r->x[j], sizeof(r->x[0])*(pos-j));
+            r->x[j] = x;
+            pos++;
+        }
+        r->num = pos;
         return;
-    qsort(r->x, r->num, sizeof(r->x[0]), compare_int32);
-    int t;
-    int pos = 1;
+    }
+    if (r->tmp_size < r->num) {
+        r->tmp_size = r->size;
+        r->tmp = realloc(r->tmp, sizeof(r->tmp[0])*r->tmp_size);
+    }
+    int32_sort(r->x, r->num, r->tmp);
     int32_t lastx=r->x[0];
-    for(t=1;t<r->num;t++) {
+    for(t=1,pos=1;t<r->num;t++) {
         if (r->x[t]!=lastx) {
             r->x[pos++] = lastx = r->x[t];
         }
@@ -124,5 +139,6 @@ void xrow_destroy(xrow_t*r)
     if (r->x) {
         free(r->x);r->x = 0;
     }
+    free(r->tmp);
     free(r);
 }
@@ -38,6 +38,8 @@ typedef struct _xrow {
     int num;
     int size;
     int32_t lastx;
+    int32_t*tmp; // for sorting
+    int tmp_size;
 } xrow_t;
 
 xrow_t* xrow_new();
@@ -0,0 +1,133 @@
+/* bench_actlist.c
+
+Compares the active list implementations on simulated sweeps.
+
+Copyright (c) 2012 Matthias Kramm <kramm@quiss.org>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE. */
+
+/* This is compiled without CHECKS (which would verify the whole list after
+   every operation), so it includes the implementation directly instead of
+   linking against the library. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "../src/active.c"
+
+typedef struct _workload {
+    const char*name;
+    int num_segments;
+    int height; // of the sweep
+    int length; // of a segment
+    int clustered; // start segments next to each other
+} workload_t;
+
+static workload_t workloads[] = {
+    {"narrow (glyphs)",      200000, 1000000,     200, 0},
+    {"medium",               200000,  100000,    1000, 0},
+    {"wide (triangle soup)", 200000,   10000,    2000, 0},
+    {"wide, clustered",      200000,   10000,    2000, 1},
+};
+
+static const char*type_names[] = {"splay tree", "blocks", "skip list"};
+
+typedef struct _ev {
+    int32_t y;
+    int start;
+    segment_t*s;
+} ev_t;
+
+static int compare_ev(const void*_e1, const void*_e2)
+{
+    const ev_t*e1 = (const ev_t*)_e1;
+    const ev_t*e2 = (const ev_t*)_e2;
+    if (e1->y != e2->y)
+        return e1->y < e2->y ? -1 : 1;
+    return e1->start - e2->start; // ends before starts
+}
+
+static double run(workload_t*w, actlist_type_t type, segment_t*segs, ev_t*events)
+{
+    int num = w->num_segments*2, t;
+    memset(segs, 0, sizeof(segment_t)*w->num_segments);
+    srand48(1);
+    for(t=0;t<w->num_segments;t++) {
+        segment_t*s = &segs[t];
+        /* vertical segments never cross, so the list stays sorted without
+           having to process crossings */
+        int32_t x = w->clustered ? (t%1000)*1000 + lrand48()%16 : lrand48()%1000000;
+        int32_t y = lrand48()%w->height;
+        s->a.x = s->b.x = x;
+        s->a.y = y;
+        s->b.y = y + 1 + lrand48()%(w->length*2);
+        s->delta.y = s->b.y - s->a.y;
+        s->k = (double)s->a.x*s->b.y - (double)s->a.y*s->b.x;
+        s->nr = t;
+        events[t*2].y = s->a.y;
+        events[t*2].start = 1;
+        events[t*2].s = s;
+        events[t*2+1].y = s->b.y;
+        events[t*2+1].start = 0;
+        events[t*2+1].s = s;
+    }
+    qsort(events, num, sizeof(ev_t), compare_ev);
+
+    struct timespec t1, t2;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    actlist_t*a = actlist_new_type(type);
+    for(t=0;t<num;t++) {
+        segment_t*s = events[t].s;
+        if (events[t].start) {
+            actlist_insert(a, s->a, s->b, s);
+        } else {
+            actlist_delete(a, s);
+        }
+    }
+    actlist_destroy(a);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
+    return (t2.tv_sec - t1.tv_sec) + (t2.tv_nsec - t1.tv_nsec) * 1e-9;
+}
+
+int main(int argn, char*argv[])
+{
+    int w, type;
+    for(w=0;w<sizeof(workloads)/sizeof(workloads[0]);w++) {
+        workload_t*wl = &workloads[w];
+        segment_t*segs = (segment_t*)malloc(sizeof(segment_t)*wl->num_segments);
+        ev_t*events = (ev_t*)malloc(sizeof(ev_t)*wl->num_segments*2);
+        int best = 0;
+        double times[3];
+        printf("%s (~%d active):", wl->name,
+                (int)((double)wl->num_segments * wl->length / wl->height));
+        for(type=0;type<3;type++) {
+            times[type] = run(wl, type, segs, events);
+            if (times[type] < times[best])
+                best = type;
+            printf(" %s %.3fs", type_names[type], times[type]);
+        }
+        printf(" -> %s\n", type_names[best]);
+        free(segs);
+        free(events);
+    }
+    return 0;
+}
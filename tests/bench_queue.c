@@ -0,0 +1,155 @@
+/* bench_queue.c
+
+Compares the sweep's inline 4-ary event heap with a binary heap of
+pointers to separately allocated events (the way the queue used to be).
+
+Copyright (c) 2012 Matthias Kramm <kramm@quiss.org>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE. */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <memory.h>
+#include <time.h>
+#include "../src/heap.h"
+
+/* an event like the sweep's: a packed (y, type) key, a point and two
+   segment pointers */
+typedef struct _ev {
+    uint64_t key;
+    int32_t y;
+    int32_t x;
+    int type;
+    int id; // breaks ties, so that both queues pop in the same order
+    void*s1;
+    void*s2;
+} ev_t;
+
+#define EV_KEY(y,type) ((uint64_t)((uint32_t)(y)^0x80000000u)<<2|(type))
+
+/* the old comparison: y, then type */
+static inline char ptr_lt(ev_t*a, ev_t*b)
+{
+    if (a->y != b->y) return a->y < b->y;
+    if (a->type != b->type) return a->type < b->type;
+    return a->id < b->id;
+}
+static inline char key_lt(ev_t*a, ev_t*b)
+{
+    if (a->key != b->key) return a->key < b->key;
+    return a->id < b->id;
+}
+HEAP_DEFINE(ptrqueue,ev_t,ptr_lt);
+HEAP_DEFINE_INLINE(inlinequeue,ev_t,key_lt);
+
+static int sizes[] = {100000, 1000000, 4000000};
+
+static void make_event(ev_t*e, int32_t y, int id)
+{
+    memset(e, 0, sizeof(ev_t));
+    e->y = y;
+    e->type = id&3;
+    e->key = EV_KEY(e->y, e->type);
+    e->id = id;
+}
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Fills the queue with num events at random y, then pops them all. Every
+   popped event schedules a later one with probability 1/2, like
+   intersections found during a sweep. Returns a checksum of the pop order. */
+static uint64_t run_ptr(int num, double*time)
+{
+    ptrqueue_t q;
+    ptrqueue_init(&q);
+    srand48(1);
+    double t1 = now();
+    int id = 0, t;
+    for(t=0;t<num;t++) {
+        ev_t*e = (ev_t*)malloc(sizeof(ev_t));
+        make_event(e, lrand48()%num, id++);
+        ptrqueue_put(&q, e);
+    }
+    uint64_t sum = 0;
+    ev_t*e;
+    while ((e = ptrqueue_get(&q))) {
+        sum = sum*31 + e->id;
+        if (lrand48()&1) {
+            ev_t*n = (ev_t*)malloc(sizeof(ev_t));
+            make_event(n, e->y + 1 + lrand48()%1000, id++);
+            ptrqueue_put(&q, n);
+        }
+        free(e);
+    }
+    *time = now() - t1;
+    ptrqueue_destroy(&q);
+    return sum;
+}
+
+static uint64_t run_inline(int num, double*time)
+{
+    inlinequeue_t q;
+    inlinequeue_init(&q);
+    srand48(1);
+    double t1 = now();
+    int id = 0, t;
+    ev_t e;
+    for(t=0;t<num;t++) {
+        make_event(&e, lrand48()%num, id++);
+        inlinequeue_put(&q, &e);
+    }
+    uint64_t sum = 0;
+    while (inlinequeue_get(&q, &e)) {
+        sum = sum*31 + e.id;
+        if (lrand48()&1) {
+            ev_t n;
+            make_event(&n, e.y + 1 + lrand48()%1000, id++);
+            inlinequeue_put(&q, &n);
+        }
+    }
+    *time = now() - t1;
+    inlinequeue_destroy(&q);
+    return sum;
+}
+
+int main(int argn, char*argv[])
+{
+    int s;
+    for(s=0;s<sizeof(sizes)/sizeof(sizes[0]);s++) {
+        double t1, t2;
+        uint64_t sum1 = run_ptr(sizes[s], &t1);
+        uint64_t sum2 = run_inline(sizes[s], &t2);
+        if (sum1 != sum2) {
+            fprintf(stderr, "queues pop events in different orders\n");
+            return 1;
+        }
+        printf("%d events: pointer heap %.3fs, inline 4-ary heap %.3fs\n", sizes[s], t1, t2);
+    }
+    return 0;
+}
@@ -0,0 +1,1011 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <memory.h>
+#include <unistd.h>
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include "gfxpoly.h"
+#include "../src/poly.h"
+#include "../src/render.h"
+#include "../src/moments.h"
+
+/* Checks the operators and the other entry points built on top of the
+   sweep against plain gfxpoly_process() calls, on random polygons. */
+
+#define NUM_CASES 400
+
+static gfxpoly_t* random_polygon(double x, double y, double size, int num_points)
+{
+    gfxline_t*line = gfxline_moveTo(gfxline_new(), x + size*drand48(), y + size*drand48());
+    gfxline_t*first = line;
+    int t;
+    for(t=1;t<num_points;t++) {
+        line = gfxline_lineTo(line, x + size*drand48(), y + size*drand48());
+    }
+    line = gfxline_lineTo(line, first->x, first->y);
+    gfxpoly_t*poly = gfxpoly_from_fill(first, DEFAULT_GRID);
+    gfxline_destroy(first);
+    return poly;
+}
+
+/* a random polygon, and another one that may or may not overlap it */
+static void random_pair(gfxpoly_t**p1, gfxpoly_t**p2)
+{
+    *p1 = random_polygon(0, 0, 100, 3 + lrand48()%10);
+    *p2 = random_polygon(-150 + 300*drand48(), -150 + 300*drand48(), 20 + 100*drand48(), 3 + lrand48()%10);
+}
+
+static int compare_strokes(const void*_s1, const void*_s2)
+{
+    gfxsegmentlist_t*s1 = *(gfxsegmentlist_t**)_s1;
+    gfxsegmentlist_t*s2 = *(gfxsegmentlist_t**)_s2;
+    if (s1->dir != s2->dir)
+        return s1->dir < s2->dir ? -1 : 1;
+    if (s1->fs != s2->fs)
+        return s1->fs < s2->fs ? -1 : 1;
+    if (s1->num_points != s2->num_points)
+        return s1->num_points < s2->num_points ? -1 : 1;
+    int t;
+    for(t=0;t<s1->num_points;t++) {
+        if (s1->points[t].y != s2->points[t].y)
+            return s1->points[t].y < s2->points[t].y ? -1 : 1;
+        if (s1->points[t].x != s2->points[t].x)
+            return s1->points[t].x < s2->points[t].x ? -1 : 1;
+    }
+    return 0;
+}
+
+static gfxsegmentlist_t** sorted_strokes(gfxpoly_t*p, int*num)
+{
+    *num = gfxpoly_num_segments(p);
+    gfxsegmentlist_t**strokes = malloc(sizeof(gfxsegmentlist_t*)*(*num+1));
+    gfxsegmentlist_t*stroke;
+    int t = 0;
+    for(stroke=p->strokes;stroke;stroke=stroke->next) {
+        strokes[t++] = stroke;
+    }
+    qsort(strokes, *num, sizeof(gfxsegmentlist_t*), compare_strokes);
+    return strokes;
+}
+
+/* Whether two polygons have the same strokes. Which of several edges lying
+   on top of each other comes first depends on the order in which the sweep
+   saw their segments, so the order of the strokes isn't compared. */
+static char polygons_equal(gfxpoly_t*p1, gfxpoly_t*p2)
+{
+    if (p1->gridsize != p2->gridsize)
+        return 0;
+    int num1, num2;
+    gfxsegmentlist_t**s1 = sorted_strokes(p1, &num1);
+    gfxsegmentlist_t**s2 = sorted_strokes(p2, &num2);
+    char equal = num1 == num2;
+    int t;
+    for(t=0;equal && t<num1;t++) {
+        equal = !compare_strokes(&s1[t], &s2[t]);
+    }
+    free(s1);
+    free(s2);
+    return equal;
+}
+
+static void check_result(const char*name, int nr, gfxpoly_t*result, gfxpoly_t*expected)
+{
+    if (!gfxpoly_check(result, 1)) {
+        fprintf(stderr, "%s: case %d: bad result polygon\n", name, nr);
+        exit(1);
+    }
+    if (!polygons_equal(result, expected)) {
+        fprintf(stderr, "%s: case %d: result doesn't match gfxpoly_process\n", name, nr);
+        exit(1);
+    }
+}
+
+/* for results which only match up to the grid resolution: compares
+   renderings, like run_ps does */
+static void check_area(const char*name, int nr, gfxpoly_t*result, gfxpoly_t*expected)
+{
+    if (!gfxpoly_check(result, 1)) {
+        fprintf(stderr, "%s: case %d: bad result polygon\n", name, nr);
+        exit(1);
+    }
+    intbbox_t bbox = intbbox_from_polygon(expected, 1.0);
+    unsigned char*bitmap1 = render_polygon(result, &bbox, 1.0, &windrule_circular, &onepolygon);
+    unsigned char*bitmap2 = render_polygon(expected, &bbox, 1.0, &windrule_circular, &onepolygon);
+    if (!compare_bitmaps(&bbox, bitmap1, bitmap2)) {
+        fprintf(stderr, "%s: case %d: result doesn't match gfxpoly_process\n", name, nr);
+        exit(1);
+    }
+    free(bitmap1);
+    free(bitmap2);
+}
+
+static void test_operators()
+{
+    int t;
+    for(t=0;t<NUM_CASES;t++) {
+        gfxpoly_t*p1,*p2;
+        random_pair(&p1, &p2);
+
+        gfxpoly_t*r = gfxpoly_intersect(p1, p2);
+        gfxpoly_t*e = gfxpoly_process(p1, p2, &windrule_intersect, &twopolygons, 0);
+        check_result("intersect", t, r, e);
+        gfxpoly_destroy(r);
+        gfxpoly_destroy(e);
+
+        r = gfxpoly_union(p1, p2);
+        e = gfxpoly_process(p1, p2, &windrule_union, &twopolygons, 0);
+        check_result("union", t, r, e);
+        gfxpoly_destroy(r);
+        gfxpoly_destroy(e);
+
+        r = gfxpoly_subtract(p1, p2);
+        e = gfxpoly_process(p1, p2, &windrule_subtract, &twopolygons, 0);
+        check_result("subtract", t, r, e);
+        gfxpoly_destroy(r);
+        gfxpoly_destroy(e);
+
+        gfxpoly_destroy(p1);
+        gfxpoly_destroy(p2);
+    }
+}
+
+static void test_predicates()
+{
+    int t;
+    for(t=0;t<NUM_CASES;t++) {
+        gfxpoly_t*p1,*p2;
+        random_pair(&p1, &p2);
+        /* results of zero width (pairs of edges on top of each other) may
+           go either way */
+        gfxpoly_t*i = gfxpoly_process(p1, p2, &windrule_intersect, &twopolygons, 0);
+        char intersects = gfxpoly_intersects(p1, p2);
+        if ((gfxpoly_area(i) != 0 && !intersects) || (!i->strokes && intersects)) {
+            fprintf(stderr, "intersects: case %d: doesn't match gfxpoly_process\n", t);
+            exit(1);
+        }
+        gfxpoly_t*s = gfxpoly_process(p2, p1, &windrule_subtract, &twopolygons, 0);
+        char contains = gfxpoly_contains(p1, p2);
+        if ((gfxpoly_area(s) != 0 && contains) || (!s->strokes && !contains)) {
+            fprintf(stderr, "contains: case %d: doesn't match gfxpoly_process\n", t);
+            exit(1);
+        }
+        if (intersects && gfxpoly_touches(p1, p2)) {
+            fprintf(stderr, "touches: case %d: polygons overlap\n", t);
+            exit(1);
+        }
+        gfxpoly_destroy(i);
+        gfxpoly_destroy(s);
+        gfxpoly_destroy(p1);
+        gfxpoly_destroy(p2);
+    }
+
+    gfxpoly_t*box1 = gfxpoly_createbox(0, 0, 10, 10, DEFAULT_GRID);
+    gfxpoly_t*box2 = gfxpoly_createbox(10, 5, 20, 20, DEFAULT_GRID);
+    gfxpoly_t*box3 = gfxpoly_createbox(11, 0, 20, 20, DEFAULT_GRID);
+    gfxpoly_t*box4 = gfxpoly_createbox(2, 2, 8, 8, DEFAULT_GRID);
+    assert(!gfxpoly_intersects(box1, box2) && gfxpoly_touches(box1, box2));
+    assert(!gfxpoly_intersects(box1, box3) && !gfxpoly_touches(box1, box3));
+    assert(gfxpoly_intersects(box1, box4) && !gfxpoly_touches(box1, box4));
+    assert(gfxpoly_contains(box1, box4) && !gfxpoly_contains(box4, box1));
+    assert(gfxpoly_contains(box1, box1) && !gfxpoly_contains(box1, box2));
+    gfxpoly_destroy(box1);
+    gfxpoly_destroy(box2);
+    gfxpoly_destroy(box3);
+    gfxpoly_destroy(box4);
+}
+
+static void test_measure()
+{
+    int t;
+    for(t=0;t<NUM_CASES/4;t++) {
+        gfxpoly_t*p1,*p2;
+        random_pair(&p1, &p2);
+        moments_t m, expected;
+        double perimeter;
+        gfxpoly_measure(p1, p2, &windrule_union, &twopolygons, &m, &perimeter);
+        gfxpoly_t*e = gfxpoly_process(p1, p2, &windrule_union, &twopolygons, &expected);
+        moments_normalize(&expected, e->gridsize);
+        /* the lengths are added up in a different order */
+        double p = 0;
+        gfxsegmentlist_t*stroke;
+        for(stroke=e->strokes;stroke;stroke=stroke->next) {
+            int i;
+            for(i=0;i<stroke->num_points-1;i++) {
+                double dx = stroke->points[i+1].x - stroke->points[i].x;
+                double dy = stroke->points[i+1].y - stroke->points[i].y;
+                p += sqrt(dx*dx + dy*dy) * e->gridsize;
+            }
+        }
+        if (memcmp(&m, &expected, sizeof(moments_t)) || fabs(perimeter - p) > 1e-9 * p) {
+            fprintf(stderr, "measure: case %d: doesn't match gfxpoly_process\n", t);
+            exit(1);
+        }
+        gfxpoly_destroy(e);
+        gfxpoly_destroy(p1);
+        gfxpoly_destroy(p2);
+    }
+}
+
+/* the winding number of the result polygon p around (x,y), or 0x7fffffff
+   if the point is too close to an edge to tell */
+static int winding(gfxpoly_t*p, double x, double y)
+{
+    x /= p->gridsize;
+    y /= p->gridsize;
+    int wind = 0;
+    gfxsegmentlist_t*stroke;
+    for(stroke=p->strokes;stroke;stroke=stroke->next) {
+        int i;
+        for(i=0;i<stroke->num_points-1;i++) {
+            point_t a = stroke->points[i];
+            point_t b = stroke->points[i+1];
+            double dx = b.x - a.x, dy = b.y - a.y;
+            double l = dx*dx + dy*dy;
+            double f = l ? ((x - a.x)*dx + (y - a.y)*dy) / l : 0;
+            f = f < 0 ? 0 : (f > 1 ? 1 : f);
+            double ex = a.x + f*dx - x, ey = a.y + f*dy - y;
+            if (ex*ex + ey*ey < 4)
+                return 0x7fffffff;
+            if (a.y == b.y || y < a.y || y >= b.y)
+                continue;
+            if (a.x + (y - a.y) * dx / dy < x)
+                wind += stroke->dir == DIR_DOWN ? 1 : -1;
+        }
+    }
+    return wind;
+}
+
+static void test_prepared()
+{
+    int t, i;
+    for(t=0;t<NUM_CASES/10;t++) {
+        gfxpoly_t*p = random_polygon(0, 0, 100, 3 + lrand48()%20);
+        gfxpoly_t*e = gfxpoly_process(p, 0, &windrule_evenodd, &onepolygon, 0);
+        gfxpoly_prepared_t*prepared = gfxpoly_prepare(p, &windrule_evenodd, &onepolygon);
+        int num = 200;
+        gfxcoord_t x[200], y[200];
+        windstate_t result[200];
+        for(i=0;i<num;i++) {
+            x[i] = -10 + 120*drand48();
+            y[i] = -10 + 120*drand48();
+        }
+        gfxpoly_prepared_query_batch(prepared, x, y, num, result);
+        for(i=0;i<num;i++) {
+            char inside = gfxpoly_prepared_contains(prepared, x[i], y[i]);
+            windstate_t w = gfxpoly_prepared_query(prepared, x[i], y[i]);
+            int wind = winding(e, x[i], y[i]);
+            if (w.is_filled != inside || result[i].is_filled != inside ||
+                (wind != 0x7fffffff && inside != (wind != 0))) {
+                fprintf(stderr, "prepared: case %d: point %f,%f doesn't match gfxpoly_process\n", t, x[i], y[i]);
+                exit(1);
+            }
+        }
+        gfxpoly_prepared_destroy(prepared);
+        gfxpoly_destroy(e);
+        gfxpoly_destroy(p);
+    }
+}
+
+static void test_intersect_box()
+{
+    int t;
+    for(t=0;t<NUM_CASES;t++) {
+        gfxpoly_t*p = random_polygon(0, 0, 100, 3 + lrand48()%20);
+        /* also intersect the result of another operation */
+        gfxpoly_t*p2 = gfxpoly_selfintersect_evenodd(p);
+        double x1 = -20 + 100*drand48();
+        double y1 = -20 + 100*drand48();
+        double x2 = x1 + 60*drand48();
+        double y2 = y1 + 60*drand48();
+        gfxpoly_t*box = gfxpoly_createbox(x1, y1, x2, y2, p->gridsize);
+
+        gfxpoly_t*r = gfxpoly_intersect(p, box);
+        gfxpoly_t*e = gfxpoly_process(p, box, &windrule_intersect, &twopolygons, 0);
+        check_result("intersect_box", t, r, e);
+        gfxpoly_destroy(r);
+        gfxpoly_destroy(e);
+
+        r = gfxpoly_intersect(p2, box);
+        e = gfxpoly_process(p2, box, &windrule_intersect, &twopolygons, 0);
+        check_result("intersect_box", t, r, e);
+        gfxpoly_destroy(r);
+        gfxpoly_destroy(e);
+
+        gfxpoly_destroy(box);
+        gfxpoly_destroy(p);
+        gfxpoly_destroy(p2);
+    }
+}
+
+static char* read_file(const char*filename, long*size)
+{
+    FILE*fi = fopen(filename, "rb");
+    fseek(fi, 0, SEEK_END);
+    *size = ftell(fi);
+    fseek(fi, 0, SEEK_SET);
+    char*data = malloc(*size);
+    fread(data, 1, *size, fi);
+    fclose(fi);
+    return data;
+}
+
+static void write_file(const char*filename, char*data, long size)
+{
+    FILE*fi = fopen(filename, "wb");
+    fwrite(data, 1, size, fi);
+    fclose(fi);
+}
+
+static void test_binfile()
+{
+    const char*filename = "run_ops.tmp";
+    int t;
+    for(t=0;t<NUM_CASES/10;t++) {
+        gfxpoly_t*p = random_polygon(0, 0, 100, 3 + lrand48()%20);
+        gfxpoly_t*e = gfxpoly_process(p, 0, &windrule_evenodd, &onepolygon, 0);
+
+        gfxpoly_save_binary(p, filename);
+        gfxpoly_t*p2 = gfxpoly_from_binary_file(filename);
+        assert(p2 && polygons_equal(p, p2));
+        gfxpoly_t*r = gfxpoly_process(p2, 0, &windrule_evenodd, &onepolygon, 0);
+        check_result("binfile", t, r, e);
+        gfxpoly_destroy(p2);
+        gfxpoly_destroy(r);
+
+        gfxpoly_packed_t*packed = gfxpoly_pack(p);
+        gfxpoly_packed_save_binary(packed, filename);
+        gfxpoly_packed_destroy(packed);
+        packed = gfxpoly_packed_map(filename);
+        assert(packed);
+        p2 = gfxpoly_unpack(packed);
+        assert(polygons_equal(p, p2));
+        gfxpoly_destroy(p2);
+        gfxpoly_packed_destroy(packed);
+
+        /* damaged files */
+        long size;
+        char*data = read_file(filename, &size);
+        int num_points = *(uint32_t*)&data[20];
+        gridpoint_t*points = (gridpoint_t*)&data[24];
+        int*offsets = (int*)&points[num_points];
+
+        write_file(filename, data, size - 1);
+        assert(!gfxpoly_from_binary_file(filename));
+
+        char*damaged = malloc(size);
+        memcpy(damaged, data, size);
+        ((int*)(damaged + ((char*)offsets - data)))[1] = 1;
+        write_file(filename, damaged, size);
+        assert(!gfxpoly_from_binary_file(filename));
+
+        memcpy(damaged, data, size);
+        ((gridpoint_t*)(damaged + ((char*)points - data)))[0].y = points[1].y + 1;
+        write_file(filename, damaged, size);
+        assert(!gfxpoly_from_binary_file(filename));
+
+        free(damaged);
+        free(data);
+        gfxpoly_destroy(e);
+        gfxpoly_destroy(p);
+    }
+    unlink(filename);
+}
+
+static void test_cache()
+{
+    gfxpoly_cache_t*cache = gfxpoly_cache_new(1<<20);
+    int num = 20;
+    gfxpoly_t**p1 = malloc(sizeof(gfxpoly_t*)*num);
+    gfxpoly_t**p2 = malloc(sizeof(gfxpoly_t*)*num);
+    int t;
+    for(t=0;t<num;t++) {
+        random_pair(&p1[t], &p2[t]);
+    }
+    for(t=0;t<NUM_CASES;t++) {
+        int i = lrand48()%num;
+        gfxpoly_t*r = gfxpoly_cache_process(cache, p1[i], p2[i], &windrule_intersect, &twopolygons);
+        gfxpoly_t*e = gfxpoly_process(p1[i], p2[i], &windrule_intersect, &twopolygons, 0);
+        check_result("cache", t, r, e);
+        gfxpoly_cache_release(cache, r);
+        gfxpoly_destroy(e);
+    }
+    gfxpoly_cache_stats_t stats;
+    gfxpoly_cache_get_stats(cache, &stats);
+    assert(stats.misses == num && stats.hits == NUM_CASES - num && !stats.evictions);
+
+    /* contexts are compared by their contents, not by their address */
+    windcontext_t context = {NULL, 1};
+    gfxpoly_t*r = gfxpoly_cache_process(cache, p1[0], NULL, &windrule_intersect, &context);
+    assert(r->strokes);
+    gfxpoly_cache_release(cache, r);
+    context.num_polygons = 2;
+    r = gfxpoly_cache_process(cache, p1[0], NULL, &windrule_intersect, &context);
+    assert(!r->strokes);
+    gfxpoly_cache_release(cache, r);
+    gfxpoly_cache_destroy(cache);
+
+    /* a cache which can only hold one result */
+    cache = gfxpoly_cache_new(1);
+    r = gfxpoly_cache_process(cache, p1[0], p2[0], &windrule_union, &twopolygons);
+    gfxpoly_t*r2 = gfxpoly_cache_process(cache, p1[1], p2[1], &windrule_union, &twopolygons);
+    gfxpoly_t*e = gfxpoly_process(p1[0], p2[0], &windrule_union, &twopolygons, 0);
+    check_result("cache", 0, r, e);
+    gfxpoly_cache_get_stats(cache, &stats);
+    assert(stats.misses == 2 && stats.evictions == 2 && !stats.num_entries);
+    gfxpoly_cache_release(cache, r);
+    gfxpoly_cache_release(cache, r2);
+    gfxpoly_destroy(e);
+    gfxpoly_cache_destroy(cache);
+
+    for(t=0;t<num;t++) {
+        gfxpoly_destroy(p1[t]);
+        gfxpoly_destroy(p2[t]);
+    }
+    free(p1);
+    free(p2);
+}
+
+static void test_mask()
+{
+    int t, i;
+    for(t=0;t<NUM_CASES/10;t++) {
+        gfxpoly_t*m = random_polygon(0, 0, 100, 3 + lrand48()%20);
+        gfxpoly_mask_t*mask = gfxpoly_mask_new(m);
+        gfxpoly_engine_t*engine = gfxpoly_engine_new();
+        for(i=0;i<10;i++) {
+            gfxpoly_t*p = random_polygon(-20 + 120*drand48(), -20 + 120*drand48(), 5 + 30*drand48(), 3 + lrand48()%10);
+            gfxpoly_t*r = i%2 ? gfxpoly_clip(mask, p) : gfxpoly_engine_clip(engine, mask, p);
+            gfxpoly_t*e = gfxpoly_process(p, m, &windrule_intersect, &twopolygons, 0);
+            check_area("mask", t, r, e);
+            gfxpoly_destroy(r);
+            gfxpoly_destroy(e);
+            gfxpoly_destroy(p);
+        }
+        gfxpoly_engine_destroy(engine);
+        gfxpoly_mask_destroy(mask);
+        gfxpoly_destroy(m);
+    }
+}
+
+static void test_incremental()
+{
+    int t;
+    for(t=0;t<NUM_CASES/10;t++) {
+        gfxpoly_t*p1,*p2;
+        random_pair(&p1, &p2);
+        gfxpoly_incremental_t*inc = gfxpoly_incremental_new(p1, p2, &windrule_intersect, &twopolygons, 1 + lrand48()%4);
+        /* the strokes added by the previous update */
+        gfxsegmentlist_t*removed[64];
+        int num_removed = 0;
+        int nr = t%2;
+        int i;
+        for(i=0;i<10;i++) {
+            gfxpoly_t*r = gfxpoly_incremental_result(inc);
+            gfxpoly_t*e = gfxpoly_process(p1, p2, &windrule_intersect, &twopolygons, 0);
+            check_result("incremental", t, r, e);
+            gfxpoly_destroy(r);
+            gfxpoly_destroy(e);
+
+            /* replace the small polygon added last time (the operands have
+               to stay closed) with one somewhere else */
+            gfxpoly_t*added = random_polygon(100*drand48(), 100*drand48(), 20, 3 + lrand48()%5);
+            gfxsegmentlist_t*new_strokes[64];
+            int num_new = 0;
+            gfxsegmentlist_t*stroke;
+            for(stroke=added->strokes;stroke;stroke=stroke->next) {
+                assert(num_new < 64);
+                new_strokes[num_new++] = stroke;
+            }
+            gfxpoly_incremental_update(inc, nr, removed, num_removed, added->strokes);
+            memcpy(removed, new_strokes, sizeof(gfxsegmentlist_t*)*num_new);
+            num_removed = num_new;
+            added->strokes = 0;
+            gfxpoly_destroy(added);
+        }
+        gfxpoly_incremental_destroy(inc);
+        gfxpoly_destroy(p1);
+        gfxpoly_destroy(p2);
+    }
+}
+
+static void test_packed()
+{
+    int t;
+    for(t=0;t<NUM_CASES/4;t++) {
+        gfxpoly_t*p1,*p2;
+        random_pair(&p1, &p2);
+        gfxpoly_packed_t*k1 = gfxpoly_pack(p1);
+        gfxpoly_packed_t*k2 = gfxpoly_pack(p2);
+        gfxpoly_t*u = gfxpoly_unpack(k1);
+        assert(polygons_equal(u, p1));
+        gfxpoly_destroy(u);
+
+        gfxbbox_t b1 = gfxpoly_calculate_bbox(p1);
+        gfxbbox_t b2 = gfxpoly_packed_calculate_bbox(k1);
+        assert(!memcmp(&b1, &b2, sizeof(gfxbbox_t)));
+
+        gfxpoly_packed_t*k = gfxpoly_process_packed(k1, k2, &windrule_intersect, &twopolygons, 0);
+        gfxpoly_t*r = gfxpoly_unpack(k);
+        gfxpoly_t*e = gfxpoly_process(p1, p2, &windrule_intersect, &twopolygons, 0);
+        check_result("packed", t, r, e);
+        gfxpoly_destroy(r);
+        gfxpoly_engine_t*engine = gfxpoly_engine_new();
+        gfxpoly_packed_t*k3 = gfxpoly_engine_process_packed(engine, k1, k2, &windrule_intersect, &twopolygons, 0);
+        r = gfxpoly_unpack(k3);
+        check_result("packed", t, r, e);
+        gfxpoly_destroy(r);
+        gfxpoly_packed_destroy(k3);
+        gfxpoly_engine_destroy(engine);
+
+        if (t%10 == 0) {
+            /* the text format, which both write the same way */
+            const char*filename = "run_ops.tmp";
+            gfxpoly_packed_save(k1, filename);
+            gfxpoly_packed_t*loaded = gfxpoly_packed_from_file(filename);
+            gfxpoly_save(p1, filename);
+            gfxpoly_t*expected = gfxpoly_from_file(filename);
+            unlink(filename);
+            r = gfxpoly_unpack(loaded);
+            assert(polygons_equal(r, expected));
+            gfxpoly_destroy(r);
+            gfxpoly_destroy(expected);
+            gfxpoly_packed_destroy(loaded);
+        }
+
+        /* to a gfxline, compared with the one of the unpacked polygon */
+        gfxline_t*line = gfxline_from_gfxpoly_packed(k);
+        gfxpoly_t*p = gfxpoly_from_fill(line, k->gridsize);
+        gfxpoly_packed_t*kp = gfxpoly_packed_from_fill(line, k->gridsize);
+        gfxline_destroy(line);
+        r = gfxpoly_unpack(kp);
+        assert(polygons_equal(r, p));
+        gfxpoly_destroy(r);
+        line = gfxline_from_gfxpoly_with_direction(e);
+        gfxpoly_t*q = gfxpoly_from_fill(line, e->gridsize);
+        gfxline_destroy(line);
+        r = gfxpoly_process(p, 0, &windrule_circular, &onepolygon, 0);
+        gfxpoly_t*e2 = gfxpoly_process(q, 0, &windrule_circular, &onepolygon, 0);
+        check_result("packed", t, r, e2);
+        gfxpoly_destroy(r);
+        gfxpoly_destroy(e2);
+        gfxpoly_destroy(p);
+        gfxpoly_destroy(q);
+        gfxpoly_packed_destroy(kp);
+
+        gfxpoly_destroy(e);
+        gfxpoly_packed_destroy(k);
+        gfxpoly_packed_destroy(k1);
+        gfxpoly_packed_destroy(k2);
+        gfxpoly_destroy(p1);
+        gfxpoly_destroy(p2);
+    }
+}
+
+static void test_union_many()
+{
+    int t, i;
+    for(t=0;t<NUM_CASES/10;t++) {
+        int num = 1 + lrand48()%8;
+        gfxpoly_t*polys[8];
+        for(i=0;i<num;i++) {
+            polys[i] = random_polygon(100*drand48(), 100*drand48(), 100, 3 + lrand48()%10);
+            if (t&1) {
+                /* also try operands which already are oriented like the
+                   results of the sweep */
+                gfxpoly_t*p = polys[i];
+                polys[i] = gfxpoly_selfintersect_evenodd(p);
+                gfxpoly_destroy(p);
+            }
+        }
+        windcontext_t context = {NULL, num};
+        gfxpoly_t*r = gfxpoly_union_many(polys, num);
+        gfxpoly_t*e = gfxpoly_process_many(polys, num, &windrule_union, &context, 0);
+        /* where edges of different operands lie on top of each other,
+           counting windings can leave a zero-width pair of edges which
+           windrule_union doesn't, so compare the filled areas */
+        check_area("union_many", t, r, e);
+        gfxpoly_destroy(r);
+        gfxpoly_destroy(e);
+        for(i=0;i<num;i++) {
+            gfxpoly_destroy(polys[i]);
+        }
+    }
+
+    /* two overlapping boxes, drawn in opposite directions */
+    gfxline_t*line = gfxline_moveTo(gfxline_new(), 0, 0);
+    gfxline_t*first = line;
+    line = gfxline_lineTo(line, 10, 0);
+    line = gfxline_lineTo(line, 10, 10);
+    line = gfxline_lineTo(line, 0, 10);
+    line = gfxline_lineTo(line, 0, 0);
+    gfxpoly_t*polys[2];
+    polys[0] = gfxpoly_from_fill(first, DEFAULT_GRID);
+    gfxline_destroy(first);
+    line = first = gfxline_moveTo(gfxline_new(), 5, 5);
+    line = gfxline_lineTo(line, 5, 15);
+    line = gfxline_lineTo(line, 15, 15);
+    line = gfxline_lineTo(line, 15, 5);
+    line = gfxline_lineTo(line, 5, 5);
+    polys[1] = gfxpoly_from_fill(first, DEFAULT_GRID);
+    gfxline_destroy(first);
+    gfxpoly_t*r = gfxpoly_union_many(polys, 2);
+    gfxpoly_t*e = gfxpoly_union(polys[0], polys[1]);
+    check_area("union_many", NUM_CASES/10, r, e);
+    assert(fabs(gfxpoly_area(r) - 175) < 1e-6);
+    gfxpoly_destroy(r);
+    gfxpoly_destroy(e);
+    gfxpoly_destroy(polys[0]);
+    gfxpoly_destroy(polys[1]);
+}
+
+static void check_expr(const char*expr, int nr, gfxpoly_t**polys, int num, gfxpoly_t*expected)
+{
+    gfxpoly_expr_t*e = gfxpoly_expr_new(expr);
+    assert(e);
+    gfxpoly_t*r = gfxpoly_expr_evaluate(e, polys, num);
+    check_result(expr, nr, r, expected);
+    gfxpoly_destroy(r);
+    gfxpoly_expr_destroy(e);
+}
+
+static void test_expr()
+{
+    int t, i;
+    for(t=0;t<NUM_CASES/10;t++) {
+        gfxpoly_t*polys[14];
+        random_pair(&polys[0], &polys[1]);
+
+        gfxpoly_t*e = gfxpoly_process(polys[0], polys[1], &windrule_intersect, &twopolygons, 0);
+        check_expr("0&1", t, polys, 2, e);
+        gfxpoly_destroy(e);
+        e = gfxpoly_process(polys[0], polys[1], &windrule_union, &twopolygons, 0);
+        check_expr("0 | 1", t, polys, 2, e);
+        gfxpoly_destroy(e);
+        e = gfxpoly_process(polys[0], polys[1], &windrule_subtract, &twopolygons, 0);
+        check_expr("0-1", t, polys, 2, e);
+        check_expr("0-(1&0)", t, polys, 2, e);
+        gfxpoly_destroy(e);
+
+        /* more operands than there's a truth table for */
+        for(i=2;i<14;i++) {
+            polys[i] = random_polygon(100*drand48(), 100*drand48(), 50, 3 + lrand48()%5);
+        }
+        windcontext_t context = {NULL, 14};
+        e = gfxpoly_process_many(polys, 14, &windrule_union, &context, 0);
+        check_expr("0|1|2|3|4|5|6|7|8|9|10|11|12|13", t, polys, 14, e);
+        gfxpoly_destroy(e);
+        context.num_polygons = 3;
+        e = gfxpoly_process_many(polys, 3, &windrule_intersect, &context, 0);
+        check_expr("(0&1)&2", t, polys, 14, e);
+        gfxpoly_destroy(e);
+
+        for(i=0;i<14;i++) {
+            gfxpoly_destroy(polys[i]);
+        }
+    }
+
+    assert(!gfxpoly_expr_new("!0"));
+    assert(!gfxpoly_expr_new("0|!1"));
+    assert(!gfxpoly_expr_new("(0|1"));
+    assert(!gfxpoly_expr_new("0|"));
+    assert(!gfxpoly_expr_new("64"));
+    gfxpoly_expr_t*e = gfxpoly_expr_new("0|2");
+    assert(!gfxpoly_expr_evaluate(e, 0, 2));
+    gfxpoly_expr_destroy(e);
+}
+
+typedef struct _edge {
+    gridpoint_t a, b;
+    segment_dir_t dir;
+    edgestyle_t*fs;
+} edge_t;
+
+typedef struct _edgelist {
+    edge_t*edges;
+    int num;
+    int size;
+    int32_t y; // the last scanline
+    char scanline_called;
+} edgelist_t;
+
+static void edgelist_add(edgelist_t*l, gridpoint_t a, gridpoint_t b, segment_dir_t dir, edgestyle_t*fs)
+{
+    if (l->num == l->size) {
+        l->size = l->size ? l->size*2 : 64;
+        l->edges = realloc(l->edges, sizeof(edge_t)*l->size);
+    }
+    /* upper (or left) end first */
+    if (b.y < a.y || (b.y == a.y && b.x < a.x)) {
+        gridpoint_t p = a;
+        a = b;
+        b = p;
+    }
+    edge_t*e = &l->edges[l->num++];
+    e->a = a;
+    e->b = b;
+    e->dir = dir;
+    e->fs = fs;
+}
+
+static int compare_edges(const void*_e1, const void*_e2)
+{
+    const edge_t*e1 = _e1;
+    const edge_t*e2 = _e2;
+    if (e1->a.y != e2->a.y) return e1->a.y < e2->a.y ? -1 : 1;
+    if (e1->a.x != e2->a.x) return e1->a.x < e2->a.x ? -1 : 1;
+    if (e1->b.y != e2->b.y) return e1->b.y < e2->b.y ? -1 : 1;
+    if (e1->b.x != e2->b.x) return e1->b.x < e2->b.x ? -1 : 1;
+    if (e1->dir != e2->dir) return e1->dir < e2->dir ? -1 : 1;
+    if (e1->fs != e2->fs) return e1->fs < e2->fs ? -1 : 1;
+    return 0;
+}
+
+static void edgelist_add_polygon(edgelist_t*l, gfxpoly_t*p)
+{
+    gfxsegmentlist_t*stroke;
+    for(stroke=p->strokes;stroke;stroke=stroke->next) {
+        int i;
+        for(i=0;i<stroke->num_points-1;i++) {
+            edgelist_add(l, stroke->points[i], stroke->points[i+1], stroke->dir, stroke->fs);
+        }
+    }
+}
+
+/* Whether two edge lists contain the same edges, in any order. Sorts both. */
+static char edgelists_equal(edgelist_t*l1, edgelist_t*l2)
+{
+    qsort(l1->edges, l1->num, sizeof(edge_t), compare_edges);
+    qsort(l2->edges, l2->num, sizeof(edge_t), compare_edges);
+    char equal = l1->num == l2->num;
+    int i;
+    for(i=0;equal && i<l1->num;i++) {
+        equal = !compare_edges(&l1->edges[i], &l2->edges[i]);
+    }
+    return equal;
+}
+
+static void sink_edge(gfxpoly_sink_t*sink, gridpoint_t a, gridpoint_t b, segment_dir_t dir, edgestyle_t*fs)
+{
+    edgelist_t*l = (edgelist_t*)sink->internal;
+    /* edges ending on or above a scanline come before it */
+    assert(!l->scanline_called || (a.y > l->y || b.y > l->y));
+    edgelist_add(l, a, b, dir, fs);
+}
+
+static void sink_scanline(gfxpoly_sink_t*sink, int32_t y)
+{
+    edgelist_t*l = (edgelist_t*)sink->internal;
+    assert(!l->scanline_called || y > l->y);
+    l->y = y;
+    l->scanline_called = 1;
+}
+
+static void* sink_finish(gfxpoly_sink_t*sink)
+{
+    return sink->internal;
+}
+
+static void test_sink()
+{
+    int t;
+    for(t=0;t<NUM_CASES/4;t++) {
+        gfxpoly_t*p1,*p2;
+        random_pair(&p1, &p2);
+        edgelist_t result;
+        memset(&result, 0, sizeof(result));
+        gfxpoly_sink_t sink;
+        memset(&sink, 0, sizeof(sink));
+        sink.edge = sink_edge;
+        sink.scanline = sink_scanline;
+        sink.finish = sink_finish;
+        sink.internal = &result;
+        void*r = gfxpoly_process_to_sink(p1, p2, &windrule_union, &twopolygons, &sink);
+        assert(r == &result);
+        assert(!result.num || result.scanline_called);
+
+        gfxpoly_t*e = gfxpoly_process(p1, p2, &windrule_union, &twopolygons, 0);
+        edgelist_t expected;
+        memset(&expected, 0, sizeof(expected));
+        edgelist_add_polygon(&expected, e);
+        if (!edgelists_equal(&result, &expected)) {
+            fprintf(stderr, "sink: case %d: edges don't match gfxpoly_process\n", t);
+            exit(1);
+        }
+        free(result.edges);
+        free(expected.edges);
+        gfxpoly_destroy(e);
+        gfxpoly_destroy(p1);
+        gfxpoly_destroy(p2);
+    }
+}
+
+/* files of a couple of megabytes are parsed in chunks, on several threads */
+static void test_parser()
+{
+    const char*filename = "run_ops.tmp";
+    FILE*fi = fopen(filename, "wb");
+    fprintf(fi, "%% gridsize %f\n", DEFAULT_GRID);
+    gfxline_t*line = gfxline_new();
+    gfxline_t*first = 0;
+    int t, i;
+    for(t=0;t<100000;t++) {
+        /* coordinates printf writes out exactly */
+        double x[3], y[3];
+        for(i=0;i<3;i++) {
+            x[i] = (t%300)*10 + (lrand48()%64)/8.0;
+            y[i] = (t/300)*10 + (lrand48()%64)/8.0;
+        }
+        line = gfxline_moveTo(line, x[0], y[0]);
+        if (!first)
+            first = line;
+        line = gfxline_lineTo(line, x[1], y[1]);
+        line = gfxline_lineTo(line, x[2], y[2]);
+        line = gfxline_lineTo(line, x[0], y[0]);
+        fprintf(fi, "%f %f moveto\n%f %f lineto\n%f %f lineto\n%f %f lineto\n",
+                x[0], y[0], x[1], y[1], x[2], y[2], x[0], y[0]);
+    }
+    fclose(fi);
+    gfxpoly_t*p = gfxpoly_from_fill(first, DEFAULT_GRID);
+    gfxline_destroy(first);
+    gfxpoly_t*p2 = gfxpoly_from_file(filename);
+    unlink(filename);
+    if (!polygons_equal(p, p2)) {
+        fprintf(stderr, "parser: file doesn't match gfxpoly_from_fill\n");
+        exit(1);
+    }
+    gfxpoly_destroy(p2);
+    gfxpoly_destroy(p);
+}
+
+static void test_actlist()
+{
+    /* one engine, switching the active list index between operations */
+    gfxpoly_engine_t*engine = gfxpoly_engine_new();
+    int t;
+    for(t=0;t<NUM_CASES;t++) {
+        gfxpoly_t*p1,*p2;
+        random_pair(&p1, &p2);
+        gfxpoly_engine_set_actlist(engine, (actlist_type_t)(t%3));
+        gfxpoly_t*r = gfxpoly_engine_process(engine, p1, p2, &windrule_evenodd, &twopolygons, 0);
+        gfxpoly_t*e = gfxpoly_process(p1, p2, &windrule_evenodd, &twopolygons, 0);
+        check_result("actlist", t, r, e);
+        gfxpoly_destroy(r);
+        gfxpoly_destroy(e);
+        gfxpoly_destroy(p1);
+        gfxpoly_destroy(p2);
+    }
+    gfxpoly_engine_destroy(engine);
+}
+
+static void check_batch(gfxpoly_job_t*jobs, int num_jobs, int num_threads)
+{
+    int t;
+    for(t=0;t<num_jobs;t++) {
+        jobs[t].result = 0;
+    }
+    gfxpoly_process_batch(jobs, num_jobs, num_threads);
+    for(t=0;t<num_jobs;t++) {
+        gfxpoly_t*e = gfxpoly_process(jobs[t].poly1, jobs[t].poly2, jobs[t].windrule, jobs[t].context, 0);
+        check_result("batch", t, jobs[t].result, e);
+        gfxpoly_destroy(jobs[t].result);
+        gfxpoly_destroy(e);
+    }
+}
+
+static void test_batch()
+{
+    windrule_t*rules[] = {&windrule_intersect, &windrule_union, &windrule_subtract};
+    int num_jobs = 60;
+    gfxpoly_job_t*jobs = malloc(sizeof(gfxpoly_job_t)*num_jobs);
+    int t;
+    for(t=0;t<num_jobs;t++) {
+        random_pair(&jobs[t].poly1, &jobs[t].poly2);
+        if (t < num_jobs/4) {
+            /* make the first worker's jobs expensive, so that the others
+               run out of work and steal from it */
+            gfxpoly_destroy(jobs[t].poly1);
+            jobs[t].poly1 = random_polygon(0, 0, 100, 200);
+        }
+        jobs[t].windrule = rules[t%3];
+        jobs[t].context = &twopolygons;
+    }
+    check_batch(jobs, num_jobs, 1);
+    check_batch(jobs, num_jobs, 3);
+    check_batch(jobs, num_jobs, num_jobs*2);
+    check_batch(jobs, num_jobs, 0);
+    check_batch(jobs, 1, 4);
+    check_batch(jobs, 0, 4);
+#ifdef __GLIBC__
+    /* threads with a stack that doesn't fit into memory can't be started,
+       so the calling thread has to do all the jobs */
+    pthread_attr_t attr, old;
+    pthread_getattr_default_np(&old);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, (size_t)1<<(sizeof(size_t)*8-2));
+    pthread_setattr_default_np(&attr);
+    check_batch(jobs, num_jobs, 4);
+    pthread_setattr_default_np(&old);
+    pthread_attr_destroy(&attr);
+    pthread_attr_destroy(&old);
+#endif
+    for(t=0;t<num_jobs;t++) {
+        gfxpoly_destroy(jobs[t].poly1);
+        gfxpoly_destroy(jobs[t].poly2);
+    }
+    free(jobs);
+}
+
+/* The parallel sweep may group edges into strokes differently than the
+   serial one, so compare the edges themselves */
+static void check_edges(const char*name, int nr, gfxpoly_t*result, gfxpoly_t*expected)
+{
+    if (!gfxpoly_check(result, 1)) {
+        fprintf(stderr, "%s: case %d: bad result polygon\n", name, nr);
+        exit(1);
+    }
+    edgelist_t l1, l2;
+    memset(&l1, 0, sizeof(l1));
+    memset(&l2, 0, sizeof(l2));
+    edgelist_add_polygon(&l1, result);
+    edgelist_add_polygon(&l2, expected);
+    if (!edgelists_equal(&l1, &l2)) {
+        fprintf(stderr, "%s: case %d: edges don't match gfxpoly_process (%d vs %d)\n", name, nr, l1.num, l2.num);
+        exit(1);
+    }
+    free(l1.edges);
+    free(l2.edges);
+}
+
+static void test_parallel()
+{
+    windrule_t*rules[] = {&windrule_intersect, &windrule_union, &windrule_subtract};
+    int threads[] = {2, 3, 8};
+    int t, i;
+    for(t=0;t<NUM_CASES/4;t++) {
+        gfxpoly_t*p1,*p2;
+        random_pair(&p1, &p2);
+        gfxpoly_t*p = random_polygon(0, 0, 100, 3 + lrand48()%40);
+        for(i=0;i<3;i++) {
+            windrule_t*rule = t&1 ? &windrule_circular : &windrule_evenodd;
+            gfxpoly_t*r = gfxpoly_process_parallel(p, 0, rule, &onepolygon, 0, threads[i]);
+            gfxpoly_t*e = gfxpoly_process(p, 0, rule, &onepolygon, 0);
+            check_edges("parallel", t, r, e);
+            gfxpoly_destroy(r);
+            gfxpoly_destroy(e);
+            r = gfxpoly_process_parallel(p1, p2, rules[t%3], &twopolygons, 0, threads[i]);
+            e = gfxpoly_process(p1, p2, rules[t%3], &twopolygons, 0);
+            check_edges("parallel", t, r, e);
+            gfxpoly_destroy(r);
+            gfxpoly_destroy(e);
+        }
+        gfxpoly_destroy(p);
+        gfxpoly_destroy(p1);
+        gfxpoly_destroy(p2);
+    }
+}
+
+int main(int argn, char*argv[])
+{
+    srand48(0);
+    test_operators();
+    test_predicates();
+    test_measure();
+    test_prepared();
+    test_intersect_box();
+    test_binfile();
+    test_cache();
+    test_mask();
+    test_incremental();
+    test_packed();
+    test_union_many();
+    test_expr();
+    test_sink();
+    test_parser();
+    test_actlist();
+    test_batch();
+    test_parallel();
+    printf("ok\n");
+    return 0;
+}
@@ -68,13 +68,16 @@ int main(int argn, char*argv[])
 
         gfxpoly_t*poly2 = gfxpoly_process(poly1, 0, rule, &onepolygon, 0);
         assert(gfxpoly_check(poly2, 1));
+        gfxpoly_t*poly3 = gfxpoly_process_parallel(poly1, 0, rule, &onepolygon, 0, 3);
+        assert(gfxpoly_check(poly3, 1));
 
         int pass;
         for(pass=0;pass<2;pass++) {
             intbbox_t bbox = intbbox_from_polygon(poly1, zoom);
             unsigned char*bitmap1 = render_polygon(poly1, &bbox, zoom, rule, &onepolygon);
             unsigned char*bitmap2 = render_polygon(poly2, &bbox, zoom, &windrule_circular, &onepolygon);
-            if (!bitmap_ok(&bbox, bitmap1) || !bitmap_ok(&bbox, bitmap2)) {
+            unsigned char*bitmap3 = render_polygon(poly3, &bbox, zoom, &windrule_circular, &onepolygon);
+            if (!bitmap_ok(&bbox, bitmap1) || !bitmap_ok(&bbox, bitmap2) || !bitmap_ok(&bbox, bitmap3)) {
                 save_two_bitmaps(&bbox, bitmap1, bitmap2, "error.png");
                 assert(!"error in bitmaps");
             }
@@ -82,16 +85,23 @@ int main(int argn, char*argv[])
                 save_two_bitmaps(&bbox, bitmap1, bitmap2, "error.png");
                 assert(!"bitmaps don't match");
             }
+            if (!compare_bitmaps(&bbox, bitmap2, bitmap3)) {
+                save_two_bitmaps(&bbox, bitmap2, bitmap3, "error.png");
+                assert(!"parallel sweep doesn't match");
+            }
             free(bitmap1);
             free(bitmap2);
+            free(bitmap3);
 
             // second pass renders the 90 rotated version
             rotate90(poly1);
             rotate90(poly2);
+            rotate90(poly3);
         }
 
         gfxpoly_destroy(poly1);
         gfxpoly_destroy(poly2);
+        gfxpoly_destroy(poly3);
     }
     closedir(_dir);
 }